@@ -0,0 +1,61 @@
+// Live input path without audio hardware: a SimulatedCapture feeding a LiveWindow and its analyzer, like the main loop
+// does. Reports the latency from the capture of a block to the end of the analysis that includes it (the frame that
+// shows it then waits for the next present), and checks that nothing is dropped over the run.
+// Usage: CaptureBench [seconds] [block frames]
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include "AudioInput.h"
+
+int main(int argc, char* args[]) {
+	const double seconds = argc > 1 ? atof(args[1]) : 10;
+	const unsigned blockFrames = argc > 2 ? unsigned(atoi(args[2])) : 256;
+	const unsigned SAMPLE_RATE = 44100, CHUNKS = 6;
+	SDL_Init(SDL_INIT_AUDIO);
+
+	// A second of a sweeping tone, looped by the capture
+	pooled_vector<int16_t> samples(SAMPLE_RATE * 2);
+	for (unsigned i = 0; i < SAMPLE_RATE; i++) {
+		samples[i * 2] = samples[i * 2 + 1] = int16_t(8000 * sin(i * 2 * M_PI * (200.0 + i * 0.05) / SAMPLE_RATE));
+	}
+
+	SimulatedCapture capture(to_array(samples), SAMPLE_RATE, SAMPLE_RATE, blockFrames);
+	// Small window so that it gets compacted a few times during the run
+	LiveWindow window(SAMPLE_RATE * 2, 16384);
+	DftProcessor processor(128);
+	DftProcessorForWav analyzer(processor, window.frames(), window.capacityFrames() * 4, capture.spec);
+	const unsigned samplesPerProcessing = processor.inSamplesPerIteration * CHUNKS;
+	const double counterFreq = double(SDL_GetPerformanceFrequency());
+
+	if (!capture.start()) {
+		fprintf(stderr, "Failed to start the simulated capture\n");
+		return 1;
+	}
+	uint64_t startCounter = SDL_GetPerformanceCounter();
+	double latencySum = 0, latencyMax = 0;
+	unsigned hops = 0, skipped = 0;
+	while ((SDL_GetPerformanceCounter() - startCounter) / counterFreq < seconds) {
+		window.pull(capture, analyzer);
+		if (window.skipTo(analyzer, samplesPerProcessing * 2)) skipped++;
+		if (window.available(analyzer) < samplesPerProcessing) {
+			// Same wait as the main loop: until the hop is expected to be complete
+			unsigned missing = samplesPerProcessing - window.available(analyzer);
+			std::this_thread::sleep_for(std::chrono::microseconds(uint64_t(missing) * 1000000 / SAMPLE_RATE));
+			continue;
+		}
+		analyzer.processDFTInChunksAndSmooth(CHUNKS, 0.2);
+		// From the arrival of the block holding the last frame analyzed (not the newest block pulled, which can be newer)
+		uint64_t analyzedArrival = window.arrivalOf(analyzer.waveBufferOffset - 1);
+		double latency = (SDL_GetPerformanceCounter() - analyzedArrival) / counterFreq + capture.bufferLatency();
+		latencySum += latency;
+		latencyMax = fmax(latencyMax, latency);
+		hops++;
+	}
+	capture.stop();
+
+	printf("%u hops of %u frames, blocks of %u frames (%.2f ms)\n", hops, samplesPerProcessing, blockFrames, capture.bufferLatency() * 1000);
+	printf("Capture to analysis: average %.2f ms, max %.2f ms; %u hops skipped, %u frames dropped\n",
+		hops ? latencySum / hops * 1000 : 0, latencyMax * 1000, skipped, unsigned(capture.droppedFrames()));
+	return 0;
+}
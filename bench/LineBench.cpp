@@ -0,0 +1,47 @@
+// Times drawPolylineAA with a full-resolution spectrum-like polyline, against a per-frame budget.
+// Usage: LineBench [width] [height] [iterations]
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "DrawingFloat.h"
+#include "Lines.h"
+
+static const double BUDGET_MICROSECONDS = 250;
+
+template<LineBlend Blend>
+static void runBenchmark(const char* name, ClampedDrawingSurface& ds, unsigned iterations) {
+	std::vector<float> xs(ds.w), ys(ds.w);
+	double total = 0, worst = 0;
+	for (unsigned it = 0; it < iterations; it++) {
+		// A new jagged wave each frame, like a live spectrum
+		for (unsigned i = 0; i < ds.w; i++) {
+			xs[i] = float(i);
+			ys[i] = float(ds.h * 0.5 + ds.h * 0.4 * sin(i * 0.05 + it * 0.1) * (rand() % 100) / 100.0);
+		}
+		auto start = std::chrono::steady_clock::now();
+		drawPolylineAA<Blend>(ds, xs.data(), ys.data(), ds.w, Color(40, 80, 120));
+		double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		total += elapsed;
+		if (elapsed > worst) worst = elapsed;
+		if (it % 64 == 0) ds.clearScreen(Color(0, 0, 0));
+	}
+	double average = total / iterations;
+	printf("%-9s %ux%u, %u vertices: avg %.2f us, worst %.2f us (budget %.0f us) %s\n", name, ds.w, ds.h, ds.w, average, worst, BUDGET_MICROSECONDS,
+		average <= BUDGET_MICROSECONDS ? "OK" : "OVER BUDGET");
+}
+
+int main(int argc, char* argv[]) {
+	unsigned width = argc > 1 ? atoi(argv[1]) : 480, height = argc > 2 ? atoi(argv[2]) : 320;
+	unsigned iterations = argc > 3 ? atoi(argv[3]) : 2000;
+
+	SDL_Surface* surface = SDL_CreateRGBSurface(0, width, height, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
+	ClampedDrawingSurface ds(surface);
+	ds.clearScreen(Color(0, 0, 0));
+
+	runBenchmark<LineBlend::Additive>("additive", ds, iterations);
+	runBenchmark<LineBlend::Alpha>("alpha", ds, iterations);
+
+	SDL_FreeSurface(surface);
+	return 0;
+}
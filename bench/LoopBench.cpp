@@ -0,0 +1,64 @@
+// Loop regions: plays many cycles of loops of various lengths (most not a multiple of the chunk size) and checks after
+// each hop that the analysis is still at the playback position, for every kind of analysis and with chunks skipped
+// like the degraded catch-up does. The playback follows the rule of AudioPlayer::fill (wraps exactly at the end).
+// Usage: LoopBench [cycles]
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include "DftProcessor.h"
+
+int main(int argc, char* args[]) {
+	const unsigned cycles = argc > 1 ? unsigned(atoi(args[1])) : 200;
+	const unsigned SAMPLE_RATE = 44100, CHUNKS = 6;
+	const uint32_t totalFrames = SAMPLE_RATE * 10;
+	pooled_vector<int16_t> samples(totalFrames * 2);
+	for (uint32_t i = 0; i < totalFrames * 2; i++) samples[i] = int16_t((i * 7919) % 16384 - 8192);
+	SDL_AudioSpec spec = {};
+	spec.freq = SAMPLE_RATE;
+	spec.channels = 2;
+
+	const char* kinds[] = { "full-rate DFT", "decimated DFT", "multi-resolution", "volume only" };
+	const uint32_t loopLengths[] = { 128, 1000, 4411, 22050, 30001 };
+	unsigned failures = 0;
+	for (unsigned kind = 0; kind < 4; kind++) {
+		for (uint32_t loopLength : loopLengths) {
+			for (unsigned skipped = 0; skipped < CHUNKS; skipped += CHUNKS - 1) {
+				DftProcessor processor(128);
+				DftProcessorForWav analyzer(processor, to_array(samples), totalFrames * 4, spec);
+				const uint32_t hop = processor.inSamplesPerIteration * CHUNKS;
+				const uint32_t loopStart = 12345, loopEnd = loopStart + loopLength;
+				analyzer.setDecimationStages(kind == 1 ? 2 : 0);
+				// Set while playing inside the future loop, like the L key does
+				uint32_t position = loopStart + loopLength / 2;
+				analyzer.seek(position);
+				analyzer.setLoop(loopStart, loopEnd);
+
+				const uint64_t hops = uint64_t(loopLength) * cycles / hop + 1;
+				uint64_t firstMismatch = 0;
+				for (uint64_t h = 1; h <= hops && !firstMismatch; h++) {
+					// Playback of one hop
+					for (uint32_t frames = hop; frames > 0; ) {
+						uint32_t count = std::min(frames, loopEnd - position);
+						position += count, frames -= count;
+						if (position == loopEnd) position = loopStart;
+					}
+					// Analysis of the same hop
+					analyzer.skipChunks(skipped);
+					const unsigned chunks = CHUNKS - skipped;
+					if (kind <= 1) analyzer.processDFTInChunksAndSmooth(chunks, 0.2);
+					else if (kind == 2) analyzer.processMultiResolutionAndSmooth(chunks, 0.2);
+					else analyzer.processVolumeOnly(chunks, 0.2);
+					if (analyzer.waveBufferOffset != position) firstMismatch = h;
+				}
+				if (firstMismatch) {
+					printf("%s, loop of %u frames, %u chunks skipped per hop: analysis at %u instead of %u after %llu hops\n", kinds[kind],
+						loopLength, skipped, analyzer.waveBufferOffset, position, (unsigned long long)firstMismatch);
+					failures++;
+				}
+			}
+		}
+		printf("%s: checked\n", kinds[kind]);
+	}
+	printf("%u cycles of each loop: %s\n", cycles, failures ? "analysis and playback drifted apart" : "analysis and playback still in phase");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+// Full-frame passes (a move, a stretch, a fade) then the upscaled presentation (presentTo, in parallel like in the main
+// loop): run one after the other over the whole surface, against queued and fused with the presentation, in bands.
+// Also checks that both give the same image, give or take the rounding at the seams of the bands.
+// Usage: PassBench [width] [height] [iterations] [scale]
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include "DrawingFloat.h"
+
+static void fillPattern(ClampedDrawingSurface& ds) {
+	for (unsigned y = 0; y < ds.h; y++) {
+		for (unsigned x = 0; x < ds.w; x++) {
+			ds.setPixel(x, y, Color(float(x * 7 % 256), float(y * 13 % 256), float((x ^ y) % 256)));
+		}
+	}
+}
+
+static const PixelPass passes[] = {
+	PixelPass::move(1, -1, Color(20, 40, 60), 40),
+	PixelPass::stretch(Color(0, 0, 0), 32),
+	PixelPass::fade(Color(255, 255, 255), 8),
+};
+
+template<typename Run>
+static double timeRuns(unsigned iterations, Run run) {
+	double total = 0;
+	for (unsigned it = 0; it < iterations; it++) {
+		auto start = std::chrono::steady_clock::now();
+		run();
+		total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	}
+	return total / iterations;
+}
+
+int main(int argc, char* argv[]) {
+	unsigned width = argc > 1 ? atoi(argv[1]) : 480, height = argc > 2 ? atoi(argv[2]) : 320;
+	unsigned iterations = argc > 3 ? atoi(argv[3]) : 200, scale = argc > 4 ? atoi(argv[4]) : 3;
+
+	SDL_Surface* surface1 = SDL_CreateRGBSurface(0, width, height, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
+	SDL_Surface* surface2 = SDL_CreateRGBSurface(0, width, height, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
+	// Stands for the window surface
+	SDL_Surface* window1 = SDL_CreateRGBSurface(0, width * scale, height * scale, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
+	SDL_Surface* window2 = SDL_CreateRGBSurface(0, width * scale, height * scale, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
+	ClampedDrawingSurface separate(surface1), fused(surface2);
+	fillPattern(separate);
+	fillPattern(fused);
+
+	double separateTime = timeRuns(iterations, [&] {
+		for (const PixelPass& pass : passes) separate.applyPass(pass);
+		separate.presentTo(window1, width * scale, height * scale);
+	});
+	double fusedTime = timeRuns(iterations, [&] {
+		for (const PixelPass& pass : passes) fused.queuePass(pass);
+		fused.presentTo(window2, width * scale, height * scale);
+	});
+
+	// The bands start from a copy of the rows above them: a pass that reads the rows it has just processed only
+	// converges there, so a channel may come out one off
+	unsigned mismatches = 0, maxDifference = 0;
+	for (unsigned y = 0; y < height * scale; y++) {
+		const Uint8* row1 = (const Uint8*)window1->pixels + y * window1->pitch;
+		const Uint8* row2 = (const Uint8*)window2->pixels + y * window2->pitch;
+		for (unsigned x = 0; x < width * scale * 4; x++) {
+			unsigned difference = unsigned(abs(row1[x] - row2[x]));
+			mismatches += difference != 0;
+			maxDifference = std::max(maxDifference, difference);
+		}
+	}
+	printf("%ux%u presented at %ux, %u passes on %u threads: separate %.1f us, fused %.1f us (%.2fx); %u channels differ, by up to %u\n",
+		width, height, scale, unsigned(sizeof(passes) / sizeof(passes[0])), WorkerPool::shared().threadCount(),
+		separateTime, fusedTime, separateTime / fusedTime, mismatches, maxDifference);
+	SDL_FreeSurface(surface1);
+	SDL_FreeSurface(surface2);
+	SDL_FreeSurface(window1);
+	SDL_FreeSurface(window2);
+	return maxDifference > 1 ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+// Compares ref<T> (intrusive, atomic count) with std::shared_ptr: copies on one thread, copies of one shared object
+// from all threads at once, and create/destroy (heap, BufferPool).
+// Usage: RefBench [iterations] [threads]
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include "Ref.h"
+
+struct Spectrum : RefClass {
+	double values[16];
+};
+
+struct PooledSpectrum : PooledRefClass {
+	double values[16];
+};
+
+struct PlainSpectrum {
+	double values[16];
+};
+
+template<typename Fn>
+static double nanosecondsPerIteration(unsigned iterations, Fn fn) {
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+// Each thread keeps copying the same object, the threads fight for its counter's cache line
+template<typename Pointer>
+static double contendedCopies(const Pointer& shared, unsigned iterations, unsigned threadCount) {
+	return nanosecondsPerIteration(iterations, [&] {
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < threadCount; t++) {
+			threads.emplace_back([&] {
+				for (unsigned i = 0; i < iterations; i++) {
+					Pointer copy(shared);
+					if (!copy) abort();
+				}
+			});
+		}
+		for (auto& thread : threads) thread.join();
+	});
+}
+
+int main(int argc, char* argv[]) {
+	unsigned iterations = argc > 1 ? atoi(argv[1]) : 10000000;
+	unsigned threadCount = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+	if (threadCount < 1) threadCount = 1;
+
+	// libstdc++'s shared_ptr skips the atomic operations until a thread has been started; the app always has workers
+	std::thread([] {}).join();
+
+	ref<Spectrum> intrusive = newref Spectrum;
+	std::shared_ptr<PlainSpectrum> shared = std::make_shared<PlainSpectrum>();
+	volatile double sink = 0;
+
+	double refCopy = nanosecondsPerIteration(iterations, [&] {
+		for (unsigned i = 0; i < iterations; i++) {
+			ref<Spectrum> copy(intrusive);
+			sink = sink + copy->values[0];
+		}
+	});
+	double sharedCopy = nanosecondsPerIteration(iterations, [&] {
+		for (unsigned i = 0; i < iterations; i++) {
+			std::shared_ptr<PlainSpectrum> copy(shared);
+			sink = sink + copy->values[0];
+		}
+	});
+	printf("copy + destroy, 1 thread:       ref %6.2f ns, shared_ptr %6.2f ns\n", refCopy, sharedCopy);
+
+	double refMove = nanosecondsPerIteration(iterations, [&] {
+		ref<Spectrum> a(intrusive), b;
+		for (unsigned i = 0; i < iterations; i++) {
+			b = std::move(a);
+			sink = sink + b->values[0];
+			a = std::move(b);
+		}
+	});
+	double sharedMove = nanosecondsPerIteration(iterations, [&] {
+		std::shared_ptr<PlainSpectrum> a(shared), b;
+		for (unsigned i = 0; i < iterations; i++) {
+			b = std::move(a);
+			sink = sink + b->values[0];
+			a = std::move(b);
+		}
+	});
+	printf("2 moves, 1 thread:              ref %6.2f ns, shared_ptr %6.2f ns\n", refMove, sharedMove);
+
+	unsigned contendedIterations = iterations / threadCount;
+	printf("copy + destroy, %2u threads:     ref %6.2f ns, shared_ptr %6.2f ns\n", threadCount,
+		contendedCopies(intrusive, contendedIterations, threadCount), contendedCopies(shared, contendedIterations, threadCount));
+
+	unsigned allocationIterations = iterations / 10;
+	double refCreate = nanosecondsPerIteration(allocationIterations, [&] {
+		for (unsigned i = 0; i < allocationIterations; i++) {
+			ref<Spectrum> object = newref Spectrum;
+			sink = sink + double(uintptr_t(object.ptr) & 1);
+		}
+	});
+	double pooledCreate = nanosecondsPerIteration(allocationIterations, [&] {
+		for (unsigned i = 0; i < allocationIterations; i++) {
+			ref<PooledSpectrum> object = newref PooledSpectrum;
+			sink = sink + double(uintptr_t(object.ptr) & 1);
+		}
+	});
+	double sharedCreate = nanosecondsPerIteration(allocationIterations, [&] {
+		for (unsigned i = 0; i < allocationIterations; i++) {
+			auto object = std::make_shared<PlainSpectrum>();
+			sink = sink + double(uintptr_t(object.get()) & 1);
+		}
+	});
+	printf("create + destroy:               ref %6.2f ns, pooled ref %6.2f ns, make_shared %6.2f ns\n", refCreate, pooledCreate, sharedCreate);
+	return 0;
+}
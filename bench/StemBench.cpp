@@ -0,0 +1,45 @@
+// Multitrack analysis throughput: one mix plus N synthetic stems analyzed per hop, with 1, 2, 4… worker threads.
+// Usage: StemBench [stems] [hops] [max threads]
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Stems.h"
+
+int main(int argc, char* args[]) {
+	const unsigned stemCount = argc > 1 ? unsigned(atoi(args[1])) : 8;
+	const unsigned hops = argc > 2 ? unsigned(atoi(args[2])) : 2000;
+	const unsigned maxThreads = argc > 3 ? unsigned(atoi(args[3])) : std::thread::hardware_concurrency();
+	const unsigned CHUNKS = 6, SAMPLE_RATE = 44100;
+	DftProcessor processor(128);
+	const uint32_t frames = (hops + 1) * CHUNKS * processor.inSamplesPerIteration;
+
+	// Each stem: a different tone plus some noise
+	StemSet stems;
+	pooled_vector<int16_t> samples(frames * 2);
+	for (unsigned s = 0; s < stemCount; s++) {
+		for (uint32_t i = 0; i < frames; i++) {
+			double value = 4000 * sin(i * 2 * M_PI * (110.0 * (s + 1)) / SAMPLE_RATE) + (rand() % 2000 - 1000);
+			samples[i * 2] = samples[i * 2 + 1] = int16_t(value);
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "stem%u", s);
+		stems.addStem(name, to_array(samples), frames, SAMPLE_RATE);
+	}
+	stems.finishLoading(processor.inSamplesPerIteration);
+	DftProcessorForWav mix(processor, stems.mixSamples(), frames * 4, stems.mixSpec());
+
+	auto analyze = [&](DftProcessorForWav& analyzer) { analyzer.processDFTInChunksAndSmooth(CHUNKS, 0.2); };
+	printf("%u stems + mix, %u hops of %u samples\n", stemCount, hops, CHUNKS * processor.inSamplesPerIteration);
+	double singleThreaded = 0;
+	for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+		WorkerPool pool(threads);
+		mix.seek(0);
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned h = 0; h < hops; h++) stems.processWithMix(mix, analyze, pool);
+		double microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / hops;
+		if (threads == 1) singleThreaded = microseconds;
+		printf("%2u threads: %8.2f us per hop (%.2fx)\n", threads, microseconds, singleThreaded / microseconds);
+	}
+	return 0;
+}
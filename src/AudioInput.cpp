@@ -0,0 +1,131 @@
+#include "AudioInput.h"
+#include <algorithm>
+#include <chrono>
+
+// About 1.5 s at 44.1 kHz: only fills up if the main loop stalls
+static const unsigned RING_FRAMES = 1 << 16;
+
+CaptureSource::CaptureSource(int sampleRate, unsigned blockFrames)
+	: samples(RING_FRAMES * 2), arrivals(RING_FRAMES / 16) {
+	SDL_zero(spec);
+	spec.freq = sampleRate;
+	spec.format = AUDIO_S16LSB;
+	spec.channels = 2;
+	spec.samples = Uint16(blockFrames);
+}
+
+void CaptureSource::push(const int16_t* frames, unsigned count) {
+	unsigned written = unsigned(samples.write(frames, count * 2) / 2);
+	if (written < count) dropped.fetch_add(count - written, std::memory_order_relaxed);
+	if (written == 0) return;
+	pushedFrames += written;
+	// A missing stamp only makes the latency of that block look like the next one's
+	Arrival arrival = { pushedFrames, SDL_GetPerformanceCounter() };
+	arrivals.write(&arrival, 1);
+}
+
+// -------------------------------------------------------
+DeviceCapture::DeviceCapture(int sampleRate, unsigned blockFrames)
+	: CaptureSource(sampleRate, blockFrames) {
+	spec.callback = callback;
+	spec.userdata = this;
+}
+
+DeviceCapture::~DeviceCapture() {
+	stop();
+}
+
+bool DeviceCapture::start() {
+	// No allowed changes: SDL converts from whatever the device does to 16-bit stereo at our rate
+	if (!deviceId) deviceId = SDL_OpenAudioDevice(NULL, 1, &spec, NULL, 0);
+	if (!deviceId) return false;
+	SDL_PauseAudioDevice(deviceId, 0);
+	return true;
+}
+
+void DeviceCapture::stop() {
+	if (deviceId) SDL_CloseAudioDevice(deviceId);
+	deviceId = 0;
+}
+
+void SDLCALL DeviceCapture::callback(void* userdata, Uint8* stream, int len) {
+	((DeviceCapture*)userdata)->push((const int16_t*)stream, unsigned(len) / 4);
+}
+
+// -------------------------------------------------------
+SimulatedCapture::SimulatedCapture(const int16_t* samples, uint32_t totalFrames, int sampleRate, unsigned blockFrames)
+	: CaptureSource(sampleRate, blockFrames), samples(samples), totalFrames(totalFrames) {
+}
+
+SimulatedCapture::~SimulatedCapture() {
+	stop();
+}
+
+bool SimulatedCapture::start() {
+	if (running) return true;
+	if (totalFrames < spec.samples) return false;
+	running = true;
+	thread = std::thread([this] { run(); });
+	return true;
+}
+
+void SimulatedCapture::stop() {
+	running = false;
+	if (thread.joinable()) thread.join();
+}
+
+void SimulatedCapture::run() {
+	using clock = std::chrono::steady_clock;
+	const unsigned blockFrames = spec.samples;
+	const auto start = clock::now();
+	uint32_t position = 0;
+	for (uint64_t block = 1; running; block++) {
+		// A block is available once its last frame has been "recorded"
+		std::this_thread::sleep_until(start + std::chrono::nanoseconds(block * blockFrames * 1000000000ull / spec.freq));
+		if (position + blockFrames > totalFrames) position = 0;
+		push(samples + position * 2, blockFrames);
+		position += blockFrames;
+	}
+}
+
+// -------------------------------------------------------
+LiveWindow::LiveWindow(uint32_t capacityFrames, uint32_t keepFrames)
+	: buffer(capacityFrames * 2), keepFrames(keepFrames) {
+}
+
+void LiveWindow::pull(CaptureSource& source, DftProcessorForWav& analyzer) {
+	// The analysis only goes forward: the blocks before it won't be asked for
+	auto analyzed = std::find_if(stamps.begin(), stamps.end(), [&](const Stamp& stamp) { return stamp.endFrame > analyzer.waveBufferOffset; });
+	stamps.erase(stamps.begin(), analyzed);
+	while (true) {
+		if (filled == capacityFrames()) {
+			// Move back what is yet to be analyzed, with keepFrames before it for the filters
+			uint32_t offset = analyzer.waveBufferOffset < filled ? analyzer.waveBufferOffset : filled;
+			if (offset <= keepFrames) break; // the analyzer is a whole buffer behind, nothing can be dropped
+			uint32_t shift = offset - keepFrames;
+			memmove(to_array(buffer), to_array(buffer) + shift * 2, (filled - shift) * 2 * sizeof(int16_t));
+			filled -= shift;
+			analyzer.rebase(shift);
+			for (auto& stamp : stamps) stamp.endFrame = stamp.endFrame > shift ? stamp.endFrame - shift : 0;
+		}
+		unsigned count = source.read(to_array(buffer) + filled * 2, capacityFrames() - filled, [&](unsigned frames, uint64_t counter) {
+			stamps.push_back(Stamp{ filled + frames, counter });
+		});
+		if (count == 0) break;
+		filled += count;
+	}
+}
+
+bool LiveWindow::skipTo(DftProcessorForWav& analyzer, uint32_t maxFrames) {
+	if (available(analyzer) <= maxFrames) return false;
+	analyzer.seek(filled - maxFrames);
+	return true;
+}
+
+uint64_t LiveWindow::arrivalOf(uint32_t frame) const {
+	for (const Stamp& stamp : stamps) {
+		if (stamp.endFrame > frame) return stamp.counter;
+	}
+	// Part of a block not fully read yet (its stamp comes with its end): the latest known is the closest
+	return stamps.empty() ? 0 : stamps.back().counter;
+}
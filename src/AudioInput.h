@@ -0,0 +1,121 @@
+#pragma once
+#include <SDL.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "SpscRing.h"
+#include "DftProcessor.h"
+
+// Live input: stereo 16-bit frames arriving in small blocks, pushed by the source's own thread into a lock-free ring
+// that the main loop drains. Each block is stamped with its arrival time (SDL performance counter), so that the
+// latency from the input to what ends up on screen can be measured.
+struct CaptureSource {
+	virtual ~CaptureSource() {}
+	CaptureSource(const CaptureSource&) = delete; // disallowed
+
+	// Returns false if it failed (see SDL_GetError)
+	virtual bool start() = 0;
+	virtual void stop() = 0;
+	// Delay before a sample reaches the ring (one device buffer), in seconds
+	double bufferLatency() const { return double(spec.samples) / spec.freq; }
+
+	// Consumer: moves at most maxFrames frames to out, returns how many. onArrival(frames, counter) is called for each
+	// block whose last frame was read, frames being how many of the frames read go up to the end of that block.
+	template<typename ArrivalFn>
+	unsigned read(int16_t* out, unsigned maxFrames, ArrivalFn onArrival) {
+		const uint64_t firstFrame = readFrames;
+		unsigned count = unsigned(samples.read(out, maxFrames * 2) / 2);
+		readFrames += count;
+		// A block read in part keeps its stamp for the next call
+		while (const Arrival* arrival = arrivals.peek()) {
+			if (arrival->endFrame > readFrames) break;
+			onArrival(unsigned(arrival->endFrame > firstFrame ? arrival->endFrame - firstFrame : 0), arrival->counter);
+			arrivals.pop();
+		}
+		return count;
+	}
+	// Frames lost because the consumer didn't keep up
+	uint64_t droppedFrames() const { return dropped.load(std::memory_order_relaxed); }
+
+	SDL_AudioSpec spec;
+
+protected:
+	CaptureSource(int sampleRate, unsigned blockFrames);
+	// Producer side
+	void push(const int16_t* frames, unsigned count);
+
+private:
+	struct Arrival {
+		uint64_t endFrame; // total frames pushed including this block
+		uint64_t counter;
+	};
+
+	SpscRing<int16_t> samples;
+	SpscRing<Arrival> arrivals;
+	uint64_t pushedFrames = 0, readFrames = 0;
+	std::atomic<uint64_t> dropped{0};
+};
+
+// Capture device through SDL (default input), with blocks of blockFrames
+struct DeviceCapture : CaptureSource {
+	DeviceCapture(int sampleRate = 48000, unsigned blockFrames = 256);
+	~DeviceCapture();
+
+	bool start() override;
+	void stop() override;
+
+private:
+	static void SDLCALL callback(void* userdata, Uint8* stream, int len);
+
+	SDL_AudioDeviceID deviceId = 0;
+};
+
+// Stand-in for a capture device: replays a 16-bit stereo buffer (looping) in blocks of blockFrames, each pushed when
+// it would have finished being recorded. Same timing as a device, without audio hardware.
+struct SimulatedCapture : CaptureSource {
+	SimulatedCapture(const int16_t* samples, uint32_t totalFrames, int sampleRate, unsigned blockFrames = 256);
+	~SimulatedCapture();
+
+	bool start() override;
+	void stop() override;
+
+private:
+	void run();
+
+	const int16_t* const samples;
+	const uint32_t totalFrames;
+	std::thread thread;
+	std::atomic<bool> running{false};
+};
+
+// The analyzers work on a linear buffer: the captured frames are appended to it and, when it is full, the last
+// keepFrames are moved back to the start (the analyzer following by rebase). Analyzers are created on frames() with
+// capacityFrames() × 4 bytes, like a wav file of that length.
+struct LiveWindow {
+	LiveWindow(uint32_t capacityFrames, uint32_t keepFrames);
+
+	const int16_t* frames() const { return to_array(buffer); }
+	uint32_t capacityFrames() const { return uint32_t(buffer.size() / 2); }
+	// Frames captured but not analyzed yet
+	uint32_t available(const DftProcessorForWav& analyzer) const { return filled > analyzer.waveBufferOffset ? filled - analyzer.waveBufferOffset : 0; }
+
+	// Appends everything the source has
+	void pull(CaptureSource& source, DftProcessorForWav& analyzer);
+	// Drops the backlog if the analyzer is more than maxFrames behind (keeps the latency bounded)
+	bool skipTo(DftProcessorForWav& analyzer, uint32_t maxFrames);
+	// Arrival time of the block containing frame (e.g. the last one an analysis included), 0 if unknown
+	uint64_t arrivalOf(uint32_t frame) const;
+
+private:
+	struct Stamp {
+		uint32_t endFrame; // in the buffer, after the last frame of the block
+		uint64_t counter;
+	};
+
+	pooled_vector<int16_t> buffer;
+	const uint32_t keepFrames;
+	uint32_t filled = 0;
+	// Blocks not fully analyzed yet, oldest first
+	std::vector<Stamp> stamps;
+};
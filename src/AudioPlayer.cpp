@@ -0,0 +1,83 @@
+#include "AudioPlayer.h"
+#include <memory.h>
+
+AudioPlayer::AudioPlayer(const int16_t* samples, uint32_t totalSamples, const SDL_AudioSpec& wavSpec)
+	: samples(samples), totalSamples(totalSamples), spec(wavSpec) {
+	spec.callback = callback;
+	spec.userdata = this;
+}
+
+AudioPlayer::~AudioPlayer() {
+	close();
+}
+
+void AudioPlayer::close() {
+	if (deviceId) SDL_CloseAudioDevice(deviceId);
+	deviceId = 0;
+}
+
+bool AudioPlayer::open() {
+	deviceId = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
+	return deviceId != 0;
+}
+
+void AudioPlayer::seek(uint32_t position) {
+	playPosition = position < totalSamples ? position : totalSamples;
+}
+
+void AudioPlayer::setLoop(uint32_t start, uint32_t end) {
+	if (end > totalSamples) end = totalSamples;
+	loopRegion = start < end ? uint64_t(start) << 32 | end : 0;
+}
+
+uint32_t AudioPlayer::audiblePosition() {
+	SDL_LockAudioDevice(deviceId);
+	const uint32_t from = filledFrom;
+	const Uint64 at = filledAt;
+	SDL_UnlockAudioDevice(deviceId);
+	if (!at) return position();
+
+	// The buffer filled at "at" is heard once the previous one has played, one buffer later
+	const double buffer = spec.samples;
+	double elapsed = double(SDL_GetPerformanceCounter() - at) / SDL_GetPerformanceFrequency() * spec.freq;
+	if (elapsed > buffer) elapsed = buffer; // the next fill is late (or paused)
+	int64_t audible = int64_t(from) - int64_t(buffer - elapsed);
+	// Still the end of the loop before the jump back (possibly several times around for loops shorter than a buffer)
+	const uint64_t region = loopRegion.load();
+	const int64_t start = loopStart(region), end = loopEnd(region);
+	if (end && from >= start && audible < start) audible = end - 1 - (start - audible - 1) % (end - start);
+	return audible > 0 ? uint32_t(audible) : 0;
+}
+
+void SDLCALL AudioPlayer::callback(void* userdata, Uint8* stream, int len) {
+	((AudioPlayer*)userdata)->fill((int16_t*)stream, uint32_t(len) / 4);
+}
+
+void AudioPlayer::fill(int16_t* out, uint32_t frames) {
+	uint32_t startPosition = playPosition.load(std::memory_order_relaxed), position = startPosition;
+	const uint64_t region = loopRegion.load();
+	const uint32_t start = loopStart(region), end = loopEnd(region) ? loopEnd(region) : totalSamples;
+	// Jumped past the end of the loop: same as if it had wrapped
+	if (loopEnd(region) && (position >= end || position < start)) position = start;
+	filledFrom = position;
+	filledAt = SDL_GetPerformanceCounter();
+
+	while (frames > 0) {
+		uint32_t count = position < end ? end - position : 0;
+		if (count > frames) count = frames;
+		memcpy(out, samples + position * 2, count * 4);
+		out += count * 2, frames -= count, position += count;
+
+		if (frames > 0) {
+			if (!loopEnd(region)) {
+				// End of the file, silence
+				memset(out, 0, frames * 4);
+				break;
+			}
+			position = start;
+		}
+	}
+
+	// A seek from the main thread during the callback wins
+	playPosition.compare_exchange_strong(startPosition, position);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <SDL.h>
+#include <stdint.h>
+#include <atomic>
+
+// Plays a 16-bit stereo buffer from the SDL audio callback instead of queuing it all at once, so that the position can
+// be changed at any time (seek, loop region) without re-queuing anything. Positions are in sample frames.
+struct AudioPlayer {
+	AudioPlayer(const int16_t* samples, uint32_t totalSamples, const SDL_AudioSpec& wavSpec);
+	~AudioPlayer();
+	AudioPlayer(const AudioPlayer&) = delete; // disallowed
+
+	// Opens the default device (paused). Returns false if it failed, see SDL_GetError.
+	bool open();
+	// Also done by the destructor; needed before SDL_Quit
+	void close();
+	void play() { SDL_PauseAudioDevice(deviceId, 0); }
+	void pause() { SDL_PauseAudioDevice(deviceId, 1); }
+
+	void seek(uint32_t position);
+	// Playback wraps from end to start; start >= end removes the loop
+	void setLoop(uint32_t start, uint32_t end);
+	void clearLoop() { setLoop(0, 0); }
+	bool looping() const { return loopEnd(loopRegion.load()) > 0; }
+
+	// Where the callback will fill from next: runs ahead of what is heard by up to two device buffers, in steps of one
+	uint32_t position() const { return playPosition.load(std::memory_order_relaxed); }
+	// What is being heard now, interpolated from the time of the last fill (assumes it plays one buffer later)
+	uint32_t audiblePosition();
+
+	const int16_t* const samples;
+	const uint32_t totalSamples;
+
+private:
+	static void SDLCALL callback(void* userdata, Uint8* stream, int len);
+	void fill(int16_t* out, uint32_t frames);
+	// Both ends in one atomic, so that the callback never sees half of a change
+	static uint32_t loopStart(uint64_t region) { return uint32_t(region >> 32); }
+	static uint32_t loopEnd(uint64_t region) { return uint32_t(region); }
+
+	SDL_AudioSpec spec;
+	SDL_AudioDeviceID deviceId = 0;
+	std::atomic<uint32_t> playPosition{0};
+	std::atomic<uint64_t> loopRegion{0};
+	// Last fill, under the device lock
+	uint32_t filledFrom = 0;
+	Uint64 filledAt = 0;
+};
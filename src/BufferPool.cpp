@@ -0,0 +1,44 @@
+#include "BufferPool.h"
+#include <new>
+
+BufferPool::~BufferPool() {
+	for (auto& entry : freeBlocks) {
+		for (void* block : entry.second) ::operator delete(block, std::align_val_t(ALIGNMENT));
+	}
+}
+
+BufferPool& BufferPool::shared() {
+	static BufferPool pool;
+	return pool;
+}
+
+void* BufferPool::allocate(size_t bytes) {
+	const size_t size = roundUp(bytes ? bytes : 1);
+	bytesInUse += size;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = freeBlocks.find(size);
+		if (it != freeBlocks.end() && !it->second.empty()) {
+			void* block = it->second.back();
+			it->second.pop_back();
+			bytesCached -= size;
+			recycledAllocations++;
+			return block;
+		}
+	}
+	heapAllocations++;
+	return ::operator new(size, std::align_val_t(ALIGNMENT));
+}
+
+void BufferPool::release(void* block, size_t bytes) {
+	if (!block) return;
+	const size_t size = roundUp(bytes ? bytes : 1);
+	bytesInUse -= size;
+	bytesCached += size;
+	std::lock_guard<std::mutex> lock(mutex);
+	freeBlocks[size].push_back(block);
+}
+
+BufferPool::Counters BufferPool::counters() const {
+	return Counters{ heapAllocations.load(), recycledAllocations.load(), bytesInUse.load(), bytesCached.load() };
+}
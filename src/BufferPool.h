@@ -0,0 +1,61 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Recycles the big buffers (surface pixels, analysis scratch space) by size, so that switching effects or running the
+// per-frame passes doesn't go to the heap once each size has been seen. Blocks are aligned for SIMD loads.
+// Thread-safe; the counters let the main loop check that steady-state frames allocate nothing.
+struct BufferPool {
+	static const size_t ALIGNMENT = 64;
+
+	struct Counters {
+		uint64_t heapAllocations;	// blocks that had to come from the heap
+		uint64_t recycledAllocations;	// blocks served from the free lists
+		uint64_t bytesInUse, bytesCached;
+	};
+
+	BufferPool() {}
+	BufferPool(const BufferPool&) = delete; // disallowed
+	~BufferPool();
+
+	void* allocate(size_t bytes);
+	// bytes must be what was passed to allocate
+	void release(void* block, size_t bytes);
+
+	template<typename T>
+	T* allocateArray(size_t count) { return static_cast<T*>(allocate(count * sizeof(T))); }
+	template<typename T>
+	void releaseArray(T* array, size_t count) { release(array, count * sizeof(T)); }
+
+	Counters counters() const;
+	static BufferPool& shared();
+
+private:
+	static size_t roundUp(size_t bytes) { return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+
+	std::mutex mutex;
+	std::unordered_map<size_t, std::vector<void*>> freeBlocks; // by rounded size
+	std::atomic<uint64_t> heapAllocations{0}, recycledAllocations{0}, bytesInUse{0}, bytesCached{0};
+};
+
+// Lets std::vector take its storage from the shared BufferPool (e.g. pooled_vector<double> for the analysis buffers)
+template<typename T>
+struct PoolAllocator {
+	typedef T value_type;
+
+	PoolAllocator() {}
+	template<typename U> PoolAllocator(const PoolAllocator<U>&) {}
+
+	T* allocate(size_t count) { return BufferPool::shared().allocateArray<T>(count); }
+	void deallocate(T* array, size_t count) { BufferPool::shared().releaseArray(array, count); }
+
+	template<typename U> bool operator == (const PoolAllocator<U>&) const { return true; }
+	template<typename U> bool operator != (const PoolAllocator<U>&) const { return false; }
+};
+
+template<typename T>
+using pooled_vector = std::vector<T, PoolAllocator<T>>;
@@ -0,0 +1,43 @@
+#include "CatchUp.h"
+
+unsigned CatchUpPolicy::onLate(double lateness, double time) {
+	stats.catchUps += 1;
+	if (mode == Mode::SkipAndDegrade && time - lastCatchUp < overloadWindow && degradeLevel < MAX_LEVEL) {
+		setLevel(degradeLevel + 1, time);
+		stats.degradedIntervals += 1;
+	}
+	lastCatchUp = time;
+	if (mode == Mode::ReplayAll) return 0;
+
+	// The last one is analyzed
+	unsigned skipped = lateness >= 2 ? unsigned(lateness) - 1 : 0;
+	stats.droppedHops += skipped;
+	return skipped;
+}
+
+unsigned CatchUpPolicy::chunksToAnalyze(unsigned processChunksAtOnce, double time) {
+	if (degradeLevel > 0 && time - lastCatchUp >= recoveryTime) {
+		setLevel(degradeLevel - 1, time);
+		// One level per recoveryTime
+		lastCatchUp = time;
+	}
+	unsigned chunks = processChunksAtOnce >> degradeLevel;
+	return chunks > 0 ? chunks : 1;
+}
+
+CatchUpPolicy::Counters CatchUpPolicy::counters(double time) const {
+	Counters result = stats;
+	if (degradeLevel > 0) result.degradedSeconds += time - degradedSince;
+	return result;
+}
+
+void CatchUpPolicy::resetCounters(double time) {
+	stats = Counters();
+	degradedSince = time;
+}
+
+void CatchUpPolicy::setLevel(unsigned level, double time) {
+	if (degradeLevel > 0) stats.degradedSeconds += time - degradedSince;
+	degradeLevel = level;
+	degradedSince = time;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+// What the main loop does when the analysis falls behind the playback. Only the latest spectrum is ever shown, so
+// analyzing every missed hop mostly costs time, which can make the lag worse.
+struct CatchUpPolicy {
+	enum class Mode {
+		ReplayAll,		// analyzes every missed hop
+		Skip,			// jumps to the playback position; seeking restarts the smoothing, so one hop is enough to warm it up
+		SkipAndDegrade,	// same, and analyzes fewer chunks per hop while the lag keeps coming back
+	};
+
+	struct Counters {
+		uint64_t droppedHops = 0;	// skipped without being analyzed
+		unsigned catchUps = 0;
+		unsigned degradedIntervals = 0;	// times the analysis was degraded (one more level each)
+		double degradedSeconds = 0;
+	};
+
+	Mode mode = Mode::SkipAndDegrade;
+	double lateHops = 20;			// lateness (in hops) that triggers a catch-up
+	double overloadWindow = 5;		// s: catching up again within that time degrades one more level
+	double recoveryTime = 10;		// s without catching up to go back up one level
+	static const unsigned MAX_LEVEL = 3;	// each level halves the chunks analyzed per hop
+
+	bool isLate(double lateness) const { return lateness >= lateHops; }
+	// Called when isLate. Returns how many hops to skip (0: replay them all).
+	unsigned onLate(double lateness, double time);
+	// Out of the processChunksAtOnce of a hop (the latest ones); at least 1
+	unsigned chunksToAnalyze(unsigned processChunksAtOnce, double time);
+	unsigned level() const { return degradeLevel; }
+
+	// Since the last reset, the time spent degraded included
+	Counters counters(double time) const;
+	void resetCounters(double time);
+
+private:
+	void setLevel(unsigned level, double time);
+
+	Counters stats;
+	unsigned degradeLevel = 0;
+	double lastCatchUp = -1e9, degradedSince = 0;
+};
@@ -0,0 +1,124 @@
+#include "Coroutines.h"
+#include <chrono>
+#include "DrawingFloat.h"
+#include "Parallel.h"
+
+static double now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool CoroutinesDetail::BudgetAwaiter::await_suspend(std::coroutine_handle<Task::promise_type> h) const noexcept {
+	FrameScheduler* scheduler = h.promise().scheduler;
+	if (!scheduler || !scheduler->budgetExhausted()) return false; // keep going
+	h.promise().wakeUpOn = WakeUpOn::NextBudget;
+	return true;
+}
+
+FrameScheduler::Entry& FrameScheduler::Entry::operator = (Entry&& other) noexcept {
+	std::swap(task, other.task);
+	std::swap(stats, other.stats);
+	std::swap(surface, other.surface);
+	std::swap(context, other.context);
+	std::swap(spectrumPending, other.spectrumPending);
+	return *this;
+}
+
+FrameScheduler::Entry::~Entry() {
+	task = Task();
+	if (surface) SurfacePool::shared().release(surface);
+}
+
+void FrameScheduler::add(Task&& task, const char* name, std::unique_ptr<RoutineContext> context) {
+	task.h_.promise().scheduler = this;
+	entries.emplace_back(std::move(task), name, std::move(context));
+	frameDeadline = now() + 1e9; // no budget for the setup part
+	resume(entries.back());
+
+	Entry& entry = entries.back();
+	if (entry.task.h_.done()) {
+		std::exception_ptr exception = entry.task.h_.promise().exception;
+		entries.pop_back();
+		if (exception) std::rethrow_exception(exception);
+	}
+}
+
+void FrameScheduler::notifySpectrum() {
+	for (auto& entry : entries) entry.spectrumPending = true;
+}
+
+bool FrameScheduler::wantsFrameTicks() const {
+	for (auto& entry : entries) {
+		if (entry.task.h_.promise().wakeUpOn != WakeUpOn::NextSpectrum) return true;
+	}
+	return false;
+}
+
+bool FrameScheduler::budgetExhausted() const {
+	return now() >= frameDeadline;
+}
+
+void FrameScheduler::resume(Entry& entry) {
+	auto& promise = entry.task.h_.promise();
+	// Whatever it waited for, the routine now sees the latest spectrum
+	entry.spectrumPending = false;
+	// Routines doing a plain co_await std::suspend_always{} don't set it
+	promise.wakeUpOn = WakeUpOn::NextSpectrum;
+
+	PresentableSurface** previousSlot = g_routineSurfaceSlot;
+	g_routineSurfaceSlot = &entry.surface;
+	double start = now();
+	// Moves queued at the end of the previous resume, if no present ran them since
+	if (entry.surface) entry.surface->flushPasses();
+	entry.task.h_.resume();
+	double cost = now() - start;
+	g_routineSurfaceSlot = previousSlot;
+
+	Stats& stats = entry.stats;
+	stats.lastCost = cost;
+	stats.averageCost = stats.resumes ? stats.averageCost * 0.9 + cost * 0.1 : cost;
+	if (cost > stats.maxCost) stats.maxCost = cost;
+	stats.resumes++;
+}
+
+unsigned FrameScheduler::runFrame(double budgetSeconds) {
+	frameDeadline = now() + budgetSeconds;
+
+	ready.clear();
+	for (auto& entry : entries) {
+		WakeUpOn wakeUpOn = entry.task.h_.promise().wakeUpOn;
+		if (wakeUpOn != WakeUpOn::NextSpectrum || entry.spectrumPending) ready.push_back(&entry);
+	}
+
+	// The routines write nothing in common (their surface slot is per thread, their options are in their context).
+	// A routine alone keeps the whole pool for its own parallelFor calls; several ones run theirs serially.
+	unsigned ran = unsigned(ready.size());
+	if (ran > 1) {
+		WorkerPool::shared().parallelFor(ran, 1, [&](unsigned begin, unsigned end) {
+			for (unsigned i = begin; i < end; i++) resume(*ready[i]);
+		});
+	}
+	else if (ran == 1) {
+		resume(*ready[0]);
+	}
+
+	std::exception_ptr exception;
+	for (size_t i = 0; i < entries.size(); ) {
+		if (entries[i].task.h_.done()) {
+			if (!exception) exception = entries[i].task.h_.promise().exception;
+			entries.erase(entries.begin() + i);
+		}
+		else {
+			i++;
+		}
+	}
+
+	if (exception) std::rethrow_exception(exception);
+	return ran;
+}
+
+void FrameScheduler::resetStats() {
+	for (auto& entry : entries) {
+		const char* name = entry.stats.name;
+		entry.stats = Stats{ name };
+	}
+}
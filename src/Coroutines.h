@@ -1,23 +1,132 @@
 #pragma once
 #include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
 
-struct ReturnObject {
+struct FrameScheduler;
+struct PresentableSurface;
+
+// What a suspended routine is waiting for before the FrameScheduler resumes it
+enum class WakeUpOn {
+	NextFrame,		// next frame ticked by the main loop (spectrum update or present)
+	NextSpectrum,	// next time the analysis produced a new spectrum (also what a bare co_await std::suspend_always{} means)
+	NextBudget,		// the budget of the current frame is exhausted, continue the work during the next frame
+};
+
+// Coroutine type of the drawing routines. It starts suspended and its frame lives as long as the Task (destroyed with
+// it). Exceptions escaping the routine are kept and rethrown by FrameScheduler::runFrame.
+struct Task {
 	struct promise_type {
-		ReturnObject get_return_object() {
-			return {
-				// Uses C++20 designated initializer syntax
-				.h_ = std::coroutine_handle<promise_type>::from_promise(*this)
-			};
+		FrameScheduler* scheduler = nullptr;
+		WakeUpOn wakeUpOn = WakeUpOn::NextSpectrum;
+		std::exception_ptr exception;
+
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
 		}
-		std::suspend_never initial_suspend() { return {}; }
-		std::suspend_never final_suspend() noexcept { return {}; }
-		void unhandled_exception() {}
+		std::suspend_always initial_suspend() { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void unhandled_exception() { exception = std::current_exception(); }
 		void return_void() {}
 	};
 
+	Task() {}
+	explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+	Task(Task&& other) noexcept : h_(other.h_) { other.h_ = nullptr; }
+	Task& operator = (Task&& other) noexcept {
+		if (this != &other) {
+			if (h_) h_.destroy();
+			h_ = other.h_;
+			other.h_ = nullptr;
+		}
+		return *this;
+	}
+	Task(const Task&) = delete; // disallowed
+	~Task() { if (h_) h_.destroy(); }
+
 	std::coroutine_handle<promise_type> h_;
-	operator std::coroutine_handle<promise_type>() const { return h_; }
-	// A coroutine_handle<promise_type> converts to coroutine_handle<>
-	operator std::coroutine_handle<>() const { return h_; }
 };
 
+namespace CoroutinesDetail {
+	struct WakeUpAwaiter {
+		WakeUpOn wakeUpOn;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<Task::promise_type> h) const noexcept { h.promise().wakeUpOn = wakeUpOn; }
+		void await_resume() const noexcept {}
+	};
+
+	struct BudgetAwaiter {
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<Task::promise_type> h) const noexcept;
+		void await_resume() const noexcept {}
+	};
+}
+
+// co_await nextFrame(); co_await nextSpectrum();
+static inline CoroutinesDetail::WakeUpAwaiter nextFrame() { return { WakeUpOn::NextFrame }; }
+static inline CoroutinesDetail::WakeUpAwaiter nextSpectrum() { return { WakeUpOn::NextSpectrum }; }
+// Put inside expensive loops: only suspends (until the next frame) once the frame budget is exhausted
+static inline CoroutinesDetail::BudgetAwaiter yieldIfOverBudget() { return {}; }
+
+// What a routine uses besides its surface (e.g. its own analysis), kept by the FrameScheduler and destroyed after it
+struct RoutineContext {
+	virtual ~RoutineContext() {}
+};
+
+// Resumes the drawing routines when what they wait for happens, keeping track of what each resume costs. Several
+// routines (e.g. during a crossfade) each draw into their own surface and read their own context: the ones ready in a
+// frame are resumed at the same time, on the WorkerPool.
+struct FrameScheduler {
+	struct Stats {
+		const char* name = nullptr;
+		double lastCost = 0, averageCost = 0, maxCost = 0; // seconds
+		unsigned resumes = 0;
+	};
+
+	FrameScheduler(const FrameScheduler&) = delete; // disallowed
+	FrameScheduler() {}
+
+	// Takes the routine and runs it up to its first suspension (where it typically has created its surface)
+	void add(Task&& task, const char* name, std::unique_ptr<RoutineContext> context = nullptr);
+	void remove(unsigned index) { entries.erase(entries.begin() + index); }
+	void clear() { entries.clear(); }
+	bool empty() const { return entries.empty(); }
+	unsigned size() const { return unsigned(entries.size()); }
+	// Surface that the routine got from createDrawingSurface (null if it didn't create one)
+	PresentableSurface* surface(unsigned index) const { return entries[index].surface; }
+	RoutineContext* context(unsigned index) const { return entries[index].context.get(); }
+
+	void notifySpectrum();
+	// Whether a routine waits for frames rather than spectrums (i.e. runFrame should be called at the display rate)
+	bool wantsFrameTicks() const;
+	// Resumes the routines that are ready, in parallel if there are several. Returns how many ran. A routine that finished is removed, and if it
+	// finished with an exception, that exception is rethrown here.
+	unsigned runFrame(double budgetSeconds);
+	bool budgetExhausted() const;
+
+	const Stats& stats(unsigned index) const { return entries[index].stats; }
+	void resetStats();
+
+private:
+	struct Entry {
+		Task task;
+		Stats stats;
+		PresentableSurface* surface = nullptr; // goes back to the SurfacePool with the routine
+		std::unique_ptr<RoutineContext> context;
+		bool spectrumPending = false;
+
+		Entry(Task&& task, const char* name, std::unique_ptr<RoutineContext> context) : task(std::move(task)), context(std::move(context)) { stats.name = name; }
+		Entry(Entry&& other) noexcept { *this = std::move(other); }
+		Entry& operator = (Entry&& other) noexcept;
+		~Entry();
+	};
+
+	void resume(Entry& entry);
+
+	std::vector<Entry> entries;
+	std::vector<Entry*> ready; // of the current frame
+	double frameDeadline = 0;
+};
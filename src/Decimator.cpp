@@ -0,0 +1,90 @@
+#include "Decimator.h"
+#include <math.h>
+#include <memory.h>
+
+HalfBandDecimator::HalfBandDecimator() {
+	// Windowed sinc with the cutoff at a quarter of the input rate: h[n] = sinc((n - c) / 2) / 2 × Blackman, c = T - 1.
+	// The branch keeps the even n, where n - c is odd (the other ones are zero, except h[c] = 1/2).
+	const unsigned length = 2 * BRANCH_TAPS - 1, center = BRANCH_TAPS - 1;
+	double sum = 0;
+	for (unsigned k = 0; k < BRANCH_TAPS; k++) {
+		unsigned n = 2 * k;
+		double x = (double(n) - center) / 2;
+		double window = 0.42 - 0.5 * cos(2 * M_PI * (n + 1) / (length + 1)) + 0.08 * cos(4 * M_PI * (n + 1) / (length + 1));
+		coefficients[k] = float(sin(M_PI * x) / (M_PI * x) / 2 * window);
+		sum += coefficients[k];
+	}
+	// DC gain of exactly 1 (the center tap brings the other half)
+	for (unsigned k = 0; k < BRANCH_TAPS; k++) coefficients[k] = float(coefficients[k] * 0.5 / sum);
+}
+
+void HalfBandDecimator::reset() {
+	even.clear();
+	odd.clear();
+	nextIsOdd = false;
+}
+
+unsigned HalfBandDecimator::process(const float* in, unsigned count, float* out) {
+	for (unsigned i = 0; i < count; i++) {
+		(nextIsOdd ? odd : even).push_back(in[i]);
+		nextIsOdd = !nextIsOdd;
+	}
+
+	// y[m] = sum(g[k] × even[m + k]) + odd[m + T/2 - 1] / 2
+	const unsigned centerOffset = BRANCH_TAPS / 2 - 1;
+	unsigned available = 0;
+	if (even.size() >= BRANCH_TAPS && odd.size() >= centerOffset + 1) {
+		available = unsigned(even.size()) - BRANCH_TAPS + 1;
+		if (odd.size() - centerOffset < available) available = unsigned(odd.size()) - centerOffset;
+	}
+
+	const float* evenPtr = even.data(), * oddPtr = odd.data();
+	unsigned m = 0;
+#ifdef USE_SSE2
+	// 4 outputs at a time: they read consecutive even samples for each tap
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; m + 4 <= available; m += 4) {
+		__m128 acc = _mm_mul_ps(_mm_loadu_ps(oddPtr + m + centerOffset), half);
+		for (unsigned k = 0; k < BRANCH_TAPS; k++) {
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(evenPtr + m + k), _mm_set1_ps(coefficients[k])));
+		}
+		_mm_storeu_ps(out + m, acc);
+	}
+#endif
+	for (; m < available; m++) {
+		float acc = oddPtr[m + centerOffset] * 0.5f;
+		for (unsigned k = 0; k < BRANCH_TAPS; k++) acc += evenPtr[m + k] * coefficients[k];
+		out[m] = acc;
+	}
+
+	even.erase(even.begin(), even.begin() + m);
+	odd.erase(odd.begin(), odd.begin() + m);
+	return m;
+}
+
+DecimatorChain::DecimatorChain(unsigned stages) : stages(stages) {
+}
+
+void DecimatorChain::reset() {
+	for (auto& stage : stages) stage.reset();
+}
+
+unsigned DecimatorChain::process(const float* in, unsigned count, float* out) {
+	if (stages.empty()) {
+		memcpy(out, in, count * sizeof(float));
+		return count;
+	}
+
+	// Ping-pong between the scratch buffers, the last stage writes to out
+	const float* src = in;
+	for (size_t s = 0; s < stages.size(); s++) {
+		float* dst = out;
+		if (s + 1 < stages.size()) {
+			scratch[s & 1].resize(count / 2 + 1);
+			dst = scratch[s & 1].data();
+		}
+		count = stages[s].process(src, count, dst);
+		src = dst;
+	}
+	return count;
+}
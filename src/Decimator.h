@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+#include "BufferPool.h"
+#include "Simd.h"
+
+// Streaming half-band low-pass + decimation by 2, in polyphase form: the even input samples go through the FIR branch
+// (the odd taps of a half-band filter are all zero, except the center one), the odd samples only through the center
+// tap. The history is kept across calls, so the input can be cut anywhere without a seam.
+struct HalfBandDecimator {
+	static const unsigned BRANCH_TAPS = 16; // 31-tap filter: flat up to 0.2 × the input rate, -70 dB above 0.35
+
+	HalfBandDecimator();
+
+	// Returns how many samples were written to out (at most count / 2 + 1)
+	unsigned process(const float* in, unsigned count, float* out);
+	void reset();
+
+	// Delay of the output, in input samples
+	static constexpr unsigned latency() { return BRANCH_TAPS - 1; }
+
+private:
+	float coefficients[BRANCH_TAPS];
+	pooled_vector<float> even, odd; // not yet consumed input, split by phase
+	bool nextIsOdd = false;
+};
+
+// Decimation by 2^stages through a cascade of half-band stages (stages = 0 just copies)
+struct DecimatorChain {
+	explicit DecimatorChain(unsigned stages = 0);
+
+	unsigned process(const float* in, unsigned count, float* out);
+	void reset();
+	unsigned factor() const { return 1u << unsigned(stages.size()); }
+
+private:
+	std::vector<HalfBandDecimator> stages;
+	pooled_vector<float> scratch[2];
+};
@@ -1,4 +1,6 @@
 ﻿#include "DftProcessor.h"
+#include <algorithm>
+#include "Simd.h"
 
 static const double TWENTY_OVER_LOG_10 = 20 / log(10);
 static const double DECIBEL_CUTOFF = -100_DB;
@@ -15,13 +17,157 @@ DftProcessor::DftProcessor(unsigned samplesPerIteration)
 	outSamplesPerIteration(samplesPerIteration / 2 + 1),
 	REX(outSamplesPerIteration), IMX(outSamplesPerIteration), samples(inSamplesPerIteration),
 	useConversionToFrequencyDomainValues(false),
-	useWindow(false)
+	useWindow(false),
+	cosTable(samplesPerIteration), sinTable(samplesPerIteration), windowTable(samplesPerIteration),
+	maxMagnitudes(4)
 {
+	const double a0 = 0.3635819, a1 = 0.4891775, a2 = 0.1365995, a3 = 0.0106411;
+	for (unsigned i = 0; i < inSamplesPerIteration; i++) {
+		double angle = 2 * M_PI * i / inSamplesPerIteration;
+		cosTable[i] = float(cos(angle));
+		sinTable[i] = float(sin(angle));
+		windowTable[i] = float(a0 - a1 * cos(angle) + a2 * cos(angle * 2) - a3 * cos(angle * 3));
+	}
 }
 
 // inData is stereo, 16-bit data (L R L R, etc.)
 // ⚠ useWindow method is not complete, it is valid only for the first half of the output samples; we should make a second pass, in which we shift the second part and process again, giving us a second first half that can be used.
 void DftProcessor::processDFT(const int16_t* inData, double* outData) {
+	for (unsigned k = 0; k < inSamplesPerIteration; k++) {
+		double data1 = double(*inData++);
+		double data2 = double(*inData++);
+		samples[k] = data1 / (32768 * 2) + data2 / (32768 * 2);
+	}
+	transformSamples(outData);
+}
+
+void DftProcessor::processDFTBatchAndSmooth(const int16_t* const* blocks, unsigned blockCount, double alpha, double* smoothedOut) {
+	const unsigned n = inSamplesPerIteration, stride = paddedBlockCount(blockCount);
+	interleaved.assign(n * stride, 0);
+	float* dst = to_array(interleaved);
+	for (unsigned b = 0; b < blockCount; b++) {
+		const int16_t* inData = blocks[b];
+		for (unsigned i = 0; i < n; i++, inData += 2) {
+			float sample = float(inData[0]) / (32768 * 2) + float(inData[1]) / (32768 * 2);
+			dst[i * stride + b] = useWindow ? sample * windowTable[i] : sample;
+		}
+	}
+	transformBatchAndSmooth(blockCount, alpha, smoothedOut);
+}
+
+void DftProcessor::processDFTBatchAndSmooth(const float* const* blocks, unsigned blockCount, double alpha, double* smoothedOut) {
+	const unsigned n = inSamplesPerIteration, stride = paddedBlockCount(blockCount);
+	interleaved.assign(n * stride, 0);
+	float* dst = to_array(interleaved);
+	for (unsigned b = 0; b < blockCount; b++) {
+		const float* src = blocks[b];
+		for (unsigned i = 0; i < n; i++) {
+			dst[i * stride + b] = useWindow ? src[i] * windowTable[i] : src[i];
+		}
+	}
+	transformBatchAndSmooth(blockCount, alpha, smoothedOut);
+}
+
+void DftProcessor::transformBatchAndSmooth(unsigned blockCount, double alpha, double* smoothedOut) {
+	if (sparse()) return transformSparseBatchAndSmooth(blockCount, alpha, smoothedOut);
+	const unsigned n = inSamplesPerIteration, stride = paddedBlockCount(blockCount);
+	const float* data = to_array(interleaved);
+	maxMagnitudes.resize(stride);
+	float* magnitudes = to_array(maxMagnitudes);
+
+	for (unsigned k = 0; k < outSamplesPerIteration; k++) {
+		// Squared magnitude of bin k, for all the blocks (the padding blocks are zero and stay at 0)
+		for (unsigned b = 0; b < stride; b += 4) {
+			unsigned phase = 0;
+#ifdef USE_SSE2
+			__m128 re = _mm_setzero_ps(), im = _mm_setzero_ps();
+			for (unsigned i = 0; i < n; i++) {
+				__m128 x = _mm_loadu_ps(data + i * stride + b);
+				re = _mm_add_ps(re, _mm_mul_ps(x, _mm_set1_ps(cosTable[phase])));
+				im = _mm_add_ps(im, _mm_mul_ps(x, _mm_set1_ps(sinTable[phase])));
+				phase += k;
+				if (phase >= n) phase -= n;
+			}
+			_mm_storeu_ps(magnitudes + b, _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+#else
+			float re[4] = {}, im[4] = {};
+			for (unsigned i = 0; i < n; i++) {
+				const float* x = data + i * stride + b;
+				for (unsigned j = 0; j < 4; j++) {
+					re[j] += x[j] * cosTable[phase];
+					im[j] += x[j] * sinTable[phase];
+				}
+				phase += k;
+				if (phase >= n) phase -= n;
+			}
+			for (unsigned j = 0; j < 4; j++) magnitudes[b + j] = re[j] * re[j] + im[j] * im[j];
+#endif
+		}
+
+		// Max-hold, then only one dB conversion per bin (it's monotonic), then the smoothing
+		float maxMagnitude = 0;
+		for (unsigned b = 0; b < blockCount; b++) maxMagnitude = fmaxf(maxMagnitude, magnitudes[b]);
+		double magnitude = sqrt(double(maxMagnitude));
+		if (useConversionToFrequencyDomainValues) {
+			// Same scaling as processDFT (https://www.dspguide.com/ch8/5.htm), the imaginary part is 0 at both ends
+			magnitude /= (k == 0 || k == outSamplesPerIteration - 1) ? n : n / 2;
+		}
+		smoothedOut[k] = (1 - alpha) * smoothedOut[k] + alpha * toDecibels(magnitude);
+	}
+}
+
+// Goertzel: s = x + 2 cos(w) s1 - s2 over the block, then |X|² = s1² + s2² - 2 cos(w) s1 s2. One multiply per sample
+// and bin (the direct sum above needs two), and 4 bins share each vector.
+void DftProcessor::transformSparseBatchAndSmooth(unsigned blockCount, double alpha, double* smoothedOut) {
+	const unsigned n = inSamplesPerIteration, stride = paddedBlockCount(blockCount), binCount = unsigned(sparseBins.size());
+	const float* data = to_array(interleaved);
+	const float* coefficients = to_array(goertzelCoefficients);
+	maxMagnitudes.assign(binCount, 0);
+	float* magnitudes = to_array(maxMagnitudes);
+
+	for (unsigned b = 0; b < blockCount; b++) {
+		for (unsigned g = 0; g < binCount; g += 4) {
+#ifdef USE_SSE2
+			const __m128 coefficient = _mm_loadu_ps(coefficients + g);
+			__m128 s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps();
+			for (unsigned i = 0; i < n; i++) {
+				__m128 s0 = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(data[i * stride + b]), _mm_mul_ps(coefficient, s1)), s2);
+				s2 = s1;
+				s1 = s0;
+			}
+			__m128 power = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(s1, s1), _mm_mul_ps(s2, s2)), _mm_mul_ps(coefficient, _mm_mul_ps(s1, s2)));
+			_mm_storeu_ps(magnitudes + g, _mm_max_ps(_mm_loadu_ps(magnitudes + g), power));
+#else
+			float s1[4] = {}, s2[4] = {};
+			for (unsigned i = 0; i < n; i++) {
+				const float x = data[i * stride + b];
+				for (unsigned j = 0; j < 4; j++) {
+					float s0 = x + coefficients[g + j] * s1[j] - s2[j];
+					s2[j] = s1[j];
+					s1[j] = s0;
+				}
+			}
+			for (unsigned j = 0; j < 4; j++) {
+				magnitudes[g + j] = fmaxf(magnitudes[g + j], s1[j] * s1[j] + s2[j] * s2[j] - coefficients[g + j] * s1[j] * s2[j]);
+			}
+#endif
+		}
+	}
+
+	for (unsigned i = 0; i < binCount; i++) {
+		const unsigned k = sparseBins[i];
+		// Padding repeats the last bin
+		if (i > 0 && k == sparseBins[i - 1]) break;
+		// The power can come out slightly negative for an empty bin
+		double magnitude = sqrt(fmax(0.0, double(magnitudes[i])));
+		if (useConversionToFrequencyDomainValues) {
+			magnitude /= (k == 0 || k == outSamplesPerIteration - 1) ? n : n / 2;
+		}
+		smoothedOut[k] = (1 - alpha) * smoothedOut[k] + alpha * toDecibels(magnitude);
+	}
+}
+
+void DftProcessor::transformSamples(double* outData) {
 	// Zero REX & IMX so they can be used as accumulators
 	for (unsigned k = 0; k < outSamplesPerIteration; k++) {
 		REX[k] = IMX[k] = 0;
@@ -29,16 +175,11 @@ void DftProcessor::processDFT(const int16_t* inData, double* outData) {
 
 	// Avant ça on applique une fenêtre: https://en.wikipedia.org/wiki/Window_function#Flat_top_window
 	const double a0 = 0.3635819, a1 = 0.4891775, a2 = 0.1365995, a3 = 0.0106411;
-	for (unsigned k = 0; k < inSamplesPerIteration; k++) {
-		double data1 = double(*inData++);
-		double data2 = double(*inData++);
-		double sample = data1 / (32768 * 2) + data2 / (32768 * 2);
-
-		if (useWindow) {
+	if (useWindow) {
+		for (unsigned k = 0; k < inSamplesPerIteration; k++) {
 			double angle = 2 * M_PI * k / inSamplesPerIteration;
-			sample *= a0 - a1 * cos(angle) + a2 * cos(angle * 2) - a3 * cos(angle * 3);
+			samples[k] *= a0 - a1 * cos(angle) + a2 * cos(angle * 2) - a3 * cos(angle * 3);
 		}
-		samples[k] = sample;
 	}
 
 	// Correlate input with the cosine and sine wave
@@ -87,18 +228,48 @@ double DftProcessor::processVolume(const int16_t* inData) {
 	return toDecibels(linearVolume);
 }
 
-// Typical: minFrequency = 50 or 80, maxFrequency = wavSpec.freq / 2
-double DftProcessor::getDftPointInterpolated(const double* dftOutData, double positionInSpectrumBetween0And1, unsigned minFrequency, unsigned maxFrequency, bool useLogarithmicScale) {
-	double frequencyEquivalentInFft;
+void DftProcessor::addSparsePoint(double positionInSpectrumBetween0And1, unsigned minFrequency, unsigned maxFrequency, bool useLogarithmicScale) {
+	unsigned index = unsigned(binPosition(positionInSpectrumBetween0And1, minFrequency, maxFrequency, useLogarithmicScale));
+	vector<unsigned> bins;
+	for (unsigned i = 0; i < sparseBins.size(); i++) {
+		if (i == 0 || sparseBins[i] != sparseBins[i - 1]) bins.push_back(sparseBins[i]);
+	}
+	if (index >= outSamplesPerIteration - 1) {
+		bins.push_back(outSamplesPerIteration - 1);
+	}
+	else {
+		bins.push_back(index);
+		bins.push_back(index + 1);
+	}
+	std::sort(bins.begin(), bins.end());
+	bins.erase(std::unique(bins.begin(), bins.end()), bins.end());
+
+	sparseBins = bins;
+	while (sparseBins.size() % 4) sparseBins.push_back(sparseBins.back());
+	goertzelCoefficients.resize(sparseBins.size());
+	for (unsigned i = 0; i < sparseBins.size(); i++) {
+		goertzelCoefficients[i] = float(2 * cos(2 * M_PI * sparseBins[i] / inSamplesPerIteration));
+	}
+}
+
+void DftProcessor::clearSparseBins() {
+	sparseBins.clear();
+}
+
+// Fractional index in the DFT table
+double DftProcessor::binPosition(double positionInSpectrumBetween0And1, unsigned minFrequency, unsigned maxFrequency, bool useLogarithmicScale) const {
 	if (useLogarithmicScale) {
 		// Min frequency in the FFT corresponds to the first entry, and it's actually 0
 		// Max frequency in the FFT is the same, it corresponds to the last entry, outSamplesPerIteration - 1
 		double frequency = minFrequency * exp(positionInSpectrumBetween0And1 * log(maxFrequency / minFrequency));
-		frequencyEquivalentInFft = outSamplesPerIteration * frequency / maxFrequency;
-	}
-	else {
-		frequencyEquivalentInFft = positionInSpectrumBetween0And1 * (outSamplesPerIteration - 1);
+		return outSamplesPerIteration * frequency / maxFrequency;
 	}
+	return positionInSpectrumBetween0And1 * (outSamplesPerIteration - 1);
+}
+
+// Typical: minFrequency = 50 or 80, maxFrequency = wavSpec.freq / 2
+double DftProcessor::getDftPointInterpolated(const double* dftOutData, double positionInSpectrumBetween0And1, unsigned minFrequency, unsigned maxFrequency, bool useLogarithmicScale) {
+	double frequencyEquivalentInFft = binPosition(positionInSpectrumBetween0And1, minFrequency, maxFrequency, useLogarithmicScale);
 
 	// Interpolate in the DFT table
 	unsigned integerIndexValue = unsigned(frequencyEquivalentInFft);
@@ -112,6 +283,197 @@ double DftProcessor::convertPointToDecibels(double sample, double cutoffDbLevel)
 	return 1 - (fmin(cutoffDbLevel, -sample) / cutoffDbLevel);
 }
 
+// -------------------------------------------------------
+MultiResolutionDft::MultiResolutionDft(unsigned sampleRate, unsigned samplesPerLevel, unsigned levels, unsigned bandCount, unsigned minFrequency)
+	: sampleRate(sampleRate), samplesPerLevel(samplesPerLevel), levels(levels), bandCount(bandCount), minFrequency(minFrequency),
+	window(samplesPerLevel), cosTable(samplesPerLevel), sinTable(samplesPerLevel),
+	decimators(levels - 1),
+	history(levels * samplesPerLevel),
+	magnitudes(levels * (samplesPerLevel / 2 + 1)),
+	firstBin(levels, samplesPerLevel), lastBin(levels, 0),
+	bandLevel(bandCount), bandBin(bandCount)
+{
+	for (unsigned i = 0; i < samplesPerLevel; i++) {
+		// Hann window, the sidelobes of the lows would otherwise leak over the whole bass range
+		window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / samplesPerLevel);
+		cosTable[i] = cos(2 * M_PI * i / samplesPerLevel);
+		sinTable[i] = sin(2 * M_PI * i / samplesPerLevel);
+	}
+
+	// Each band is read from the most decimated level that still has it in the lower half of its spectrum (the upper
+	// half belongs to the previous level, with 2x shorter windows, and is where the decimation filter rolls off)
+	const unsigned halfBins = samplesPerLevel / 2;
+	for (unsigned b = 0; b < bandCount; b++) {
+		double frequency = bandFrequency(b);
+		unsigned level = 0;
+		while (level + 1 < levels && frequency <= double(sampleRate >> (level + 1)) / 4) level++;
+		double bin = frequency * samplesPerLevel / (sampleRate >> level);
+		if (bin > halfBins) bin = halfBins;
+		bandLevel[b] = level;
+		bandBin[b] = bin;
+		unsigned first = unsigned(bin), last = first + 1 < halfBins ? first + 1 : halfBins;
+		if (first < firstBin[level]) firstBin[level] = first;
+		if (last > lastBin[level]) lastBin[level] = last;
+	}
+}
+
+double MultiResolutionDft::bandFrequency(unsigned band) const {
+	double maxFrequency = sampleRate / 2.0;
+	return minFrequency * exp(double(band) / (bandCount - 1) * log(maxFrequency / minFrequency));
+}
+
+void MultiResolutionDft::reset() {
+	for (auto& decimator : decimators) decimator.reset();
+	for (auto& sample : history) sample = 0;
+}
+
+void MultiResolutionDft::feed(const int16_t* inData, unsigned count) {
+	// Level 0 is the mono signal at full rate, each decimator then feeds the next level with what it produced
+	scratch[0].resize(count);
+	scratch[1].resize(count / 2 + 1);
+	for (unsigned i = 0; i < count; i++, inData += 2) {
+		scratch[0][i] = float(inData[0]) / (32768 * 2) + float(inData[1]) / (32768 * 2);
+	}
+
+	pushToLevel(0, scratch[0].data(), count);
+	for (unsigned l = 1; l < levels; l++) {
+		pooled_vector<float>& src = scratch[(l - 1) & 1], & dst = scratch[l & 1];
+		dst.resize(count / 2 + 1);
+		count = decimators[l - 1].process(src.data(), count, dst.data());
+		pushToLevel(l, dst.data(), count);
+	}
+}
+
+void MultiResolutionDft::pushToLevel(unsigned level, const float* samples, unsigned count) {
+	float* levelHistory = to_array(history) + level * samplesPerLevel;
+	if (count >= samplesPerLevel) {
+		memcpy(levelHistory, samples + count - samplesPerLevel, samplesPerLevel * sizeof(float));
+		return;
+	}
+	memmove(levelHistory, levelHistory + count, (samplesPerLevel - count) * sizeof(float));
+	memcpy(levelHistory + samplesPerLevel - count, samples, count * sizeof(float));
+}
+
+void MultiResolutionDft::analyze(double* outBands) {
+	for (unsigned l = 0; l < levels; l++) computeLevel(l);
+
+	const unsigned binsPerLevel = samplesPerLevel / 2 + 1;
+	for (unsigned b = 0; b < bandCount; b++) {
+		const double* levelMagnitudes = to_array(magnitudes) + bandLevel[b] * binsPerLevel;
+		unsigned bin = unsigned(bandBin[b]);
+		double fraction = bandBin[b] - bin;
+		double magnitude = bin + 1 < binsPerLevel ? levelMagnitudes[bin] * (1 - fraction) + levelMagnitudes[bin + 1] * fraction : levelMagnitudes[bin];
+		outBands[b] = toDecibels(magnitude);
+	}
+}
+
+// DFT of the samples of the level, only for the bins that bands use
+void MultiResolutionDft::computeLevel(unsigned level) {
+	if (firstBin[level] > lastBin[level]) return;
+	const unsigned n = samplesPerLevel;
+	const float* samples = to_array(history) + level * n;
+	double* windowed = stackArray(double, n);
+	for (unsigned i = 0; i < n; i++) windowed[i] = samples[i] * window[i];
+
+	// Amplitude of a sine: 2 / n for the one-sided spectrum, and 2 again to make up for the Hann window
+	const double scale = 4.0 / n;
+	double* out = to_array(magnitudes) + level * (n / 2 + 1);
+	for (unsigned k = firstBin[level]; k <= lastBin[level]; k++) {
+		double re = 0, im = 0;
+		unsigned phase = 0;
+		for (unsigned i = 0; i < n; i++) {
+			re += windowed[i] * cosTable[phase];
+			im += windowed[i] * sinTable[phase];
+			phase += k;
+			if (phase >= n) phase -= n;
+		}
+		out[k] = sqrt(re * re + im * im) * scale;
+	}
+}
+
+// -------------------------------------------------------
+SlidingDft::SlidingDft(unsigned size, unsigned reanchorInterval)
+	: size(size), reanchorInterval(reanchorInterval),
+	ring(size), re(size / 2 + 1), im(size / 2 + 1), cosTable(size), sinTable(size) {
+	for (unsigned i = 0; i < size; i++) {
+		cosTable[i] = cos(2 * M_PI * i / size);
+		sinTable[i] = sin(2 * M_PI * i / size);
+	}
+	reset();
+}
+
+void SlidingDft::reset() {
+	for (auto& sample : ring) sample = 0;
+	for (unsigned k = 0; k <= size / 2; k++) re[k] = im[k] = 0;
+	position = sinceAnchor = 0;
+}
+
+void SlidingDft::feed(const int16_t* inData, unsigned count) {
+	// Sliding costs about as much per sample as re-anchoring per bin: past size samples, only the last ones matter
+	if (count >= size) {
+		inData += (count - size) * 2;
+		for (unsigned i = 0; i < size; i++, inData += 2) ring[i] = double(inData[0]) / (32768 * 2) + double(inData[1]) / (32768 * 2);
+		position = 0;
+		reanchor();
+		return;
+	}
+
+	for (unsigned i = 0; i < count; i++, inData += 2) {
+		double sample = double(inData[0]) / (32768 * 2) + double(inData[1]) / (32768 * 2);
+		double delta = sample - ring[position];
+		ring[position] = sample;
+		if (++position == size) position = 0;
+		// X[k] = (X[k] + new - oldest) × e^(2iπk/size): the window moved by one sample
+		for (unsigned k = 0; k <= size / 2; k++) {
+			double r = re[k] + delta, j = im[k];
+			re[k] = r * cosTable[k] - j * sinTable[k];
+			im[k] = r * sinTable[k] + j * cosTable[k];
+		}
+	}
+	sinceAnchor += count;
+	if (sinceAnchor >= reanchorInterval) reanchor();
+}
+
+void SlidingDft::reanchor() {
+	for (unsigned k = 0; k <= size / 2; k++) {
+		double r = 0, j = 0;
+		unsigned phase = 0;
+		for (unsigned m = 0; m < size; m++) {
+			double sample = ring[(position + m) % size];
+			r += sample * cosTable[phase];
+			j -= sample * sinTable[phase];
+			phase += k;
+			if (phase >= size) phase -= size;
+		}
+		re[k] = r, im[k] = j;
+	}
+	sinceAnchor = 0;
+}
+
+void SlidingDft::bin(int k, double& outRe, double& outIm) const {
+	// Real input: X[-k] = X[size - k] = conj(X[k])
+	bool conjugate = k < 0;
+	unsigned index = unsigned(conjugate ? -k : k);
+	if (index > size / 2) index = size - index, conjugate = !conjugate;
+	outRe = re[index];
+	outIm = conjugate ? -im[index] : im[index];
+}
+
+double SlidingDft::magnitude(unsigned k, bool useWindow) const {
+	if (!useWindow) return sqrt(re[k] * re[k] + im[k] * im[k]);
+	// The window is a sum of cosines: multiplying by cos(2πjm/size) averages the bins k - j and k + j
+	static const double a[4] = { 0.3635819, -0.4891775 / 2, 0.1365995 / 2, -0.0106411 / 2 };
+	double sumRe = a[0] * re[k], sumIm = a[0] * im[k];
+	for (int j = 1; j < 4; j++) {
+		double r1, i1, r2, i2;
+		bin(int(k) - j, r1, i1);
+		bin(int(k) + j, r2, i2);
+		sumRe += a[j] * (r1 + r2);
+		sumIm += a[j] * (i1 + i2);
+	}
+	return sqrt(sumRe * sumRe + sumIm * sumIm);
+}
+
 // -------------------------------------------------------
 DftProcessorForWav::DftProcessorForWav(DftProcessor& processor, const int16_t* wavBuffer, uint32_t wavLength, const SDL_AudioSpec& wavSpec)
 	: processor(processor),
@@ -120,56 +482,196 @@ DftProcessorForWav::DftProcessorForWav(DftProcessor& processor, const int16_t* w
 	dftOut(processor.outSamplesPerIteration),
 	waveBufferOffset(0),
 	waveTotalSamples(wavLength / sizeof(wavBuffer[0]) / wavSpec.channels),
-	nextValues(processor.outSamplesPerIteration),
-	temp(processor.outSamplesPerIteration)
+	multiResolution(wavSpec.freq),
+	bandsNext(multiResolution.bandCount),
+	bandsOut(multiResolution.bandCount, DECIBEL_CUTOFF),
+	decimatedSamples(processor.inSamplesPerIteration),
+	sliding(processor.inSamplesPerIteration),
+	slidingMax(processor.outSamplesPerIteration),
+	decimatorOffset(0),
+	multiResolutionOffset(0),
+	slidingOffset(0),
+	loopStart(0),
+	loopEnd(0),
+	warmUpPending(false)
 {
 }
 
 bool DftProcessorForWav::wouldOverflowWavFile()
 {
-	return waveBufferOffset + processor.inSamplesPerIteration > waveTotalSamples;
+	return !looping() && waveBufferOffset + processor.inSamplesPerIteration > waveTotalSamples;
 }
 
-void DftProcessorForWav::processDFTInChunksAndSmooth(unsigned processingChunks, double alpha) {
-	for (unsigned i = 0; i < processingChunks; i++) {
-		if (wouldOverflowWavFile()) return;
+void DftProcessorForWav::seek(uint32_t samplePosition) {
+	waveBufferOffset = samplePosition < waveTotalSamples ? samplePosition : waveTotalSamples;
+	warmUpPending = true;
+}
 
-		if (i == 0) {
-			processor.processDFT(wavBuffer + waveBufferOffset * wavSpec.channels, to_array(nextValues));
+void DftProcessorForWav::setLoop(uint32_t start, uint32_t end) {
+	if (end > waveTotalSamples) end = waveTotalSamples;
+	// Needs room for at least one chunk
+	if (start + processor.inSamplesPerIteration > end) start = end = 0;
+	loopStart = start;
+	loopEnd = end;
+}
+
+void DftProcessorForWav::rebase(uint32_t frames) {
+	waveBufferOffset = waveBufferOffset > frames ? waveBufferOffset - frames : 0;
+	// The streaming filters go on as if nothing happened (0 restarts them)
+	decimatorOffset = decimatorOffset > frames ? decimatorOffset - frames : 0;
+	multiResolutionOffset = multiResolutionOffset > frames ? multiResolutionOffset - frames : 0;
+	slidingOffset = slidingOffset > frames ? slidingOffset - frames : 0;
+	clearLoop();
+}
+
+uint32_t DftProcessorForWav::nextChunk() {
+	const unsigned n = processor.inSamplesPerIteration;
+	uint32_t start = waveBufferOffset;
+	if (!looping()) {
+		waveBufferOffset += n;
+		return start;
+	}
+	// Outside of the loop (just set, or after a seek): the playback goes to its start too
+	if (start < loopStart || start >= loopEnd) start = loopStart;
+	waveBufferOffset = start + n;
+	if (waveBufferOffset >= loopEnd) {
+		// The playback wraps exactly at loopEnd and goes on from loopStart for the rest of the chunk: so does the
+		// offset, while the chunk analyzed is the last full one before loopEnd (setLoop makes sure there's room)
+		waveBufferOffset = loopStart + (waveBufferOffset - loopEnd);
+		start = loopEnd - n;
+	}
+	return start;
+}
+
+void DftProcessorForWav::skipChunks(unsigned count) {
+	while (count-- > 0) nextChunk();
+}
+
+double DftProcessorForWav::takeAlpha(double alpha) {
+	if (!warmUpPending) return alpha;
+	warmUpPending = false;
+	return 1;
+}
+
+void DftProcessorForWav::processDFTInChunksAndSmooth(unsigned processingChunks, double alpha) {
+	const unsigned n = processor.inSamplesPerIteration;
+	unsigned blockCount = 0;
+	if (decimator.factor() > 1) {
+		// Each chunk goes through the decimator, but a window of n decimated samples spans factor() chunks: one DFT
+		// every factor() chunks (and at the last one) covers the hop without overlap, so the decimation divides the
+		// number of DFTs instead of adding its cost on top of them
+		decimatedBlocks.resize(processingChunks * n);
+		const float** blocks = stackArray(const float*, processingChunks);
+		auto takeBlock = [&] {
+			blocks[blockCount] = to_array(decimatedBlocks) + blockCount * n;
+			memcpy(to_array(decimatedBlocks) + blockCount * n, to_array(decimatedSamples), n * sizeof(float));
+			blockCount++;
+		};
+		unsigned chunksSinceBlock = 0;
+		for (unsigned chunk = 0; chunk < processingChunks; chunk++) {
+			if (wouldOverflowWavFile()) break;
+			feedDecimator(nextChunk() + n);
+			if (++chunksSinceBlock == decimator.factor()) {
+				takeBlock();
+				chunksSinceBlock = 0;
+			}
 		}
-		else {
-			processor.processDFT(wavBuffer + waveBufferOffset * wavSpec.channels, to_array(temp));
-			for (unsigned i = 0; i < processor.outSamplesPerIteration; i++) nextValues[i] = fmax(nextValues[i], temp[i]);
+		if (chunksSinceBlock > 0) takeBlock();
+		if (blockCount > 0) processor.processDFTBatchAndSmooth(blocks, blockCount, takeAlpha(alpha), to_array(dftOut));
+	}
+	else {
+		const int16_t** blocks = stackArray(const int16_t*, processingChunks);
+		for (; blockCount < processingChunks; blockCount++) {
+			if (wouldOverflowWavFile()) break;
+			blocks[blockCount] = wavBuffer + nextChunk() * wavSpec.channels;
 		}
+		if (blockCount > 0) processor.processDFTBatchAndSmooth(blocks, blockCount, takeAlpha(alpha), to_array(dftOut));
+	}
+}
 
-		waveBufferOffset += processor.inSamplesPerIteration;
+void DftProcessorForWav::processSlidingAndSmooth(uint32_t untilOffset, double alpha) {
+	const unsigned n = processor.inSamplesPerIteration;
+	if (untilOffset > waveTotalSamples) untilOffset = waveTotalSamples;
+	// After a seek, a jump back (loop) or a stall, start again from the last n samples, fed at once
+	unsigned step = n / 4;
+	if (warmUpPending || untilOffset < slidingOffset || untilOffset - slidingOffset > sliding.reanchorInterval) {
+		sliding.reset();
+		slidingOffset = untilOffset > n ? untilOffset - n : 0;
+		step = n;
 	}
+	for (auto& magnitude : slidingMax) magnitude = 0;
+	do {
+		// Less than n samples per feed, so that the window slides instead of being recomputed
+		unsigned count = untilOffset - slidingOffset < step ? untilOffset - slidingOffset : step;
+		sliding.feed(wavBuffer + slidingOffset * wavSpec.channels, count);
+		slidingOffset += count;
+		step = n / 4;
+		for (unsigned k = 0; k < processor.outSamplesPerIteration; k++) {
+			slidingMax[k] = fmax(slidingMax[k], sliding.magnitude(k, processor.useWindow));
+		}
+	} while (slidingOffset < untilOffset);
+	waveBufferOffset = untilOffset;
 
-	for (unsigned i = 0; i < processor.outSamplesPerIteration; i++) {
-		dftOut[i] = (1 - alpha) * dftOut[i] + alpha * nextValues[i];
+	alpha = takeAlpha(alpha);
+	for (unsigned k = 0; k < processor.outSamplesPerIteration; k++) {
+		double magnitude = slidingMax[k];
+		if (processor.useConversionToFrequencyDomainValues) {
+			// Same scaling as processDFT
+			magnitude /= (k == 0 || k == processor.outSamplesPerIteration - 1) ? n : n / 2;
+		}
+		dftOut[k] = (1 - alpha) * dftOut[k] + alpha * toDecibels(magnitude);
 	}
 }
 
-const vector<double>& DftProcessorForWav::currentDFT() {
+const pooled_vector<double>& DftProcessorForWav::currentDFT() {
 	return dftOut;
 }
 
+void DftProcessorForWav::processMultiResolutionAndSmooth(unsigned processingChunks, double alpha) {
+	for (unsigned i = 0; i < processingChunks; i++) {
+		if (wouldOverflowWavFile()) break;
+		uint32_t chunkEnd = nextChunk() + processor.inSamplesPerIteration;
+		// Wrapped into the loop: the end of the loop is fed on its own (the feed restarts after the jump back)
+		if (chunkEnd != waveBufferOffset) feedMultiResolution(chunkEnd);
+	}
+
+	// The long windows of the lows already span several chunks, so analyze once, at the end of what was consumed
+	feedMultiResolution(waveBufferOffset);
+	multiResolution.analyze(to_array(bandsNext));
+	alpha = takeAlpha(alpha);
+	for (unsigned i = 0; i < multiResolution.bandCount; i++) {
+		bandsOut[i] = (1 - alpha) * bandsOut[i] + alpha * bandsNext[i];
+	}
+}
+
+const pooled_vector<double>& DftProcessorForWav::currentBands() {
+	return bandsOut;
+}
+
+double DftProcessorForWav::getBandInterpolated(double positionBetween0And1) {
+	double position = fmin(fmax(positionBetween0And1, 0), 1) * (multiResolution.bandCount - 1);
+	unsigned index = unsigned(position);
+	if (index >= multiResolution.bandCount - 1) return bandsOut[multiResolution.bandCount - 1];
+	double fraction = position - index;
+	return bandsOut[index] * (1 - fraction) + bandsOut[index + 1] * fraction;
+}
+
 void DftProcessorForWav::processVolumeOnly(unsigned processingChunks, double alpha) {
 	double volume;
 	for (unsigned i = 0; i < processingChunks; i++) {
 		if (wouldOverflowWavFile()) return;
 
+		const int16_t* chunk = wavBuffer + nextChunk() * wavSpec.channels;
 		if (i == 0) {
-			volume = processor.processVolume(wavBuffer + waveBufferOffset * wavSpec.channels);
+			volume = processor.processVolume(chunk);
 		}
 		else {
-			double temp = processor.processVolume(wavBuffer + waveBufferOffset * wavSpec.channels);
+			double temp = processor.processVolume(chunk);
 			volume = fmax(volume, temp);
 		}
-
-		waveBufferOffset += processor.inSamplesPerIteration;
 	}
 
+	alpha = takeAlpha(alpha);
 	for (unsigned i = 0; i < processor.outSamplesPerIteration; i++) {
 		dftOut[i] = (1 - alpha) * dftOut[i] + alpha * volume;
 	}
@@ -179,3 +681,51 @@ void DftProcessorForWav::processDFT() {
 	processor.processDFT(wavBuffer + waveBufferOffset * wavSpec.channels, to_array(dftOut));
 	waveBufferOffset += processor.inSamplesPerIteration;
 }
+
+void DftProcessorForWav::setDecimationStages(unsigned stages) {
+	if (decimator.factor() == 1u << stages) return;
+	decimator = DecimatorChain(stages);
+	decimatorOffset = 0; // restarts on the next feed
+}
+
+// Starting over (e.g. after a jump) from far enough back for the filters to have settled
+static uint32_t restartOffset(uint32_t fedOffset, uint32_t untilOffset, uint32_t historySamples) {
+	if (fedOffset > 0 && fedOffset <= untilOffset && untilOffset - fedOffset <= historySamples) return fedOffset;
+	return untilOffset > historySamples ? untilOffset - historySamples : 0;
+}
+
+void DftProcessorForWav::feedDecimator(uint32_t untilOffset) {
+	const unsigned n = processor.inSamplesPerIteration;
+	const uint32_t historySamples = (n + 2 * HalfBandDecimator::latency()) * decimator.factor();
+	uint32_t offset = restartOffset(decimatorOffset, untilOffset, historySamples);
+	if (offset != decimatorOffset) {
+		decimator.reset();
+		for (auto& sample : decimatedSamples) sample = 0;
+	}
+
+	const unsigned count = untilOffset - offset;
+	const int16_t* src = wavBuffer + offset * wavSpec.channels;
+	monoSamples.resize(count);
+	decimatedOut.resize(count / 2 + 1);
+	for (unsigned i = 0; i < count; i++, src += 2) {
+		monoSamples[i] = float(src[0]) / (32768 * 2) + float(src[1]) / (32768 * 2);
+	}
+	unsigned produced = decimator.process(to_array(monoSamples), count, to_array(decimatedOut));
+
+	// Slide the window of the last n decimated samples
+	if (produced >= n) {
+		memcpy(to_array(decimatedSamples), to_array(decimatedOut) + produced - n, n * sizeof(float));
+	}
+	else {
+		memmove(to_array(decimatedSamples), to_array(decimatedSamples) + produced, (n - produced) * sizeof(float));
+		memcpy(to_array(decimatedSamples) + n - produced, to_array(decimatedOut), produced * sizeof(float));
+	}
+	decimatorOffset = untilOffset;
+}
+
+void DftProcessorForWav::feedMultiResolution(uint32_t untilOffset) {
+	uint32_t offset = restartOffset(multiResolutionOffset, untilOffset, multiResolution.historySamples());
+	if (offset != multiResolutionOffset) multiResolution.reset();
+	multiResolution.feed(wavBuffer + offset * wavSpec.channels, untilOffset - offset);
+	multiResolutionOffset = untilOffset;
+}
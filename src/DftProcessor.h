@@ -5,6 +5,8 @@
 #include <memory.h>
 #include <vector>
 #include "Ref.h"
+#include "BufferPool.h"
+#include "Decimator.h"
 #include <inttypes.h>
 #include <math.h>
 #include <stdlib.h>
@@ -13,8 +15,8 @@ using std::vector;
 
 #define stackArray(type, count)	((type*)alloca(sizeof(type) * count))
 
-template <typename T> T* to_array(vector<T>& a) { return &a[0]; }
-template <typename T> const T* to_array(const vector<T>& a) { return &a[0]; }
+template <typename T, typename A> T* to_array(vector<T, A>& a) { return &a[0]; }
+template <typename T, typename A> const T* to_array(const vector<T, A>& a) { return &a[0]; }
 
 template <typename T, unsigned N> constexpr unsigned numberof(const T(&)[N]) { return N; }
 
@@ -25,7 +27,23 @@ struct DftProcessor {
 	DftProcessor(unsigned samplesPerIteration);
 
 	void processDFT(const int16_t* inData, double* outData);
+	// Transforms blockCount blocks at once and folds them into smoothedOut in the same sweep over the bins:
+	// smoothedOut[k] = (1 - alpha) × smoothedOut[k] + alpha × dB(max of the blocks at k), i.e. what processDFT for each
+	// block, then a max, then an exponential smoothing would give. The blocks are interleaved so that each twiddle
+	// factor is applied to all of them with one SIMD operation.
+	// blocks: blockCount pointers to inSamplesPerIteration stereo 16-bit samples
+	void processDFTBatchAndSmooth(const int16_t* const* blocks, unsigned blockCount, double alpha, double* smoothedOut);
+	// blocks: blockCount pointers to inSamplesPerIteration mono samples in [-1, 1] (e.g. out of a DecimatorChain)
+	void processDFTBatchAndSmooth(const float* const* blocks, unsigned blockCount, double alpha, double* smoothedOut);
 	double processVolume(const int16_t* inData);
+	// Sparse mode: processDFTBatchAndSmooth then only computes the bins registered here (Goertzel filters, 4 bins at a
+	// time), the others keep their last value. For effects that read a few points of the spectrum.
+	// Registers the two bins that getDftPointInterpolated reads for that point.
+	void addSparsePoint(double positionInSpectrumBetween0And1, unsigned minFrequency, unsigned maxFrequency, bool useLogarithmicScale);
+	// Back to computing all the bins
+	void clearSparseBins();
+	// Whether processDFTBatchAndSmooth currently leaves the unregistered bins as they were
+	bool sparse() const { return useSparseBins && !sparseBins.empty(); }
 	double getDftPointInterpolated(const double* dftOutData, double positionInSpectrumBetween0And1, unsigned minFrequency, unsigned maxFrequency, bool useLogarithmicScale);
 	static double convertPointToDecibels(double sample, double cutoffDbLevel);
 
@@ -34,9 +52,81 @@ struct DftProcessor {
 	// Can be set freely
 	bool useConversionToFrequencyDomainValues;
 	bool useWindow;
+	bool useSparseBins = true; // false computes all the bins even if some are registered
 
 private:
-	vector<double> REX, IMX, samples;
+	void transformSamples(double* outData);
+	void transformBatchAndSmooth(unsigned blockCount, double alpha, double* smoothedOut);
+	void transformSparseBatchAndSmooth(unsigned blockCount, double alpha, double* smoothedOut);
+	double binPosition(double positionInSpectrumBetween0And1, unsigned minFrequency, unsigned maxFrequency, bool useLogarithmicScale) const;
+	unsigned paddedBlockCount(unsigned blockCount) const { return (blockCount + 3) & ~3u; }
+
+	pooled_vector<double> REX, IMX, samples;
+	pooled_vector<float> cosTable, sinTable, windowTable;
+	pooled_vector<float> interleaved; // sample i of block b at i × paddedBlockCount + b
+	pooled_vector<float> maxMagnitudes; // squared
+	vector<unsigned> sparseBins; // sorted, padded to a multiple of 4 with the last one
+	pooled_vector<float> goertzelCoefficients; // 2 cos(2πk / n) of each sparse bin
+};
+
+// Constant-Q style analysis: one short DFT per octave, each level running on the signal decimated by 2 once more than
+// the previous one. The highs come from the full-rate DFT, the lows from the most decimated ones (narrow bins, long
+// window), and everything is merged into bandCount log-spaced bands, without paying for one huge DFT.
+// The levels are fed as a stream (see HalfBandDecimator), each one keeping its last samplesPerLevel samples.
+struct MultiResolutionDft {
+	MultiResolutionDft(unsigned sampleRate, unsigned samplesPerLevel = 128, unsigned levels = 6, unsigned bandCount = 256, unsigned minFrequency = 40);
+
+	// Stereo, 16-bit samples following the ones fed before
+	void feed(const int16_t* inData, unsigned count);
+	// Back to silence, e.g. before feeding from another position
+	void reset();
+	// outBands receives the amplitude of each band in dB (like processDFT with useConversionToFrequencyDomainValues)
+	void analyze(double* outBands);
+	double bandFrequency(unsigned band) const;
+	// Input needed for the most decimated level to be filled with fresh samples
+	unsigned historySamples() const { return (samplesPerLevel + HalfBandDecimator::latency()) << (levels - 1); }
+
+	const unsigned sampleRate, samplesPerLevel, levels, bandCount, minFrequency;
+
+private:
+	void pushToLevel(unsigned level, const float* samples, unsigned count);
+	void computeLevel(unsigned level);
+
+	pooled_vector<double> window, cosTable, sinTable;
+	vector<HalfBandDecimator> decimators;	// decimators[l] produces level l + 1 from level l
+	pooled_vector<float> history;		// level l: last samplesPerLevel samples, at l * samplesPerLevel
+	pooled_vector<float> scratch[2];
+	pooled_vector<double> magnitudes;	// level l: samplesPerLevel / 2 + 1 bins, at l * (samplesPerLevel / 2 + 1)
+	vector<unsigned> firstBin, lastBin;	// bins of each level that some band uses
+	vector<unsigned> bandLevel;
+	pooled_vector<double> bandBin;
+};
+
+// Sliding DFT: the spectrum of the last size samples, updated for each new sample with one complex rotation per bin
+// (O(size) per sample) instead of transforming the whole window again. The rotations drift slowly, so the bins are
+// recomputed from the samples (re-anchored) every reanchorInterval samples, or whenever that is cheaper than sliding.
+struct SlidingDft {
+	SlidingDft(unsigned size, unsigned reanchorInterval = 4096);
+
+	// Stereo, 16-bit samples following the ones fed before
+	void feed(const int16_t* inData, unsigned count);
+	// Back to silence
+	void reset();
+	// Magnitude of bin k (0 to size / 2), like the DFT of DftProcessor; the window (flat top, same as useWindow) is
+	// applied in the frequency domain
+	double magnitude(unsigned k, bool useWindow) const;
+
+	const unsigned size, reanchorInterval;
+
+private:
+	void reanchor();
+	// Bin k of the full spectrum, k in (-size, size)
+	void bin(int k, double& re, double& im) const;
+
+	pooled_vector<double> ring;		// the last size samples, the oldest at position
+	pooled_vector<double> re, im;	// size / 2 + 1 bins
+	pooled_vector<double> cosTable, sinTable;
+	unsigned position = 0, sinceAnchor = 0;
 };
 
 struct DftProcessorForWav {
@@ -51,11 +141,61 @@ struct DftProcessorForWav {
 	void processDFT();
 	void processDFTInChunksAndSmooth(unsigned processingChunks, double alpha);
 	void processVolumeOnly(unsigned processingChunks, double alpha);
-	const vector<double>& currentDFT();
+	const pooled_vector<double>& currentDFT();
+	// Never true while a loop is set
 	bool wouldOverflowWavFile();
 
+	// Moves the analysis (O(1), nothing in between is processed). The next processing starts from fresh values instead
+	// of smoothing from the old position, and the decimators restart from just before the new position.
+	void seek(uint32_t samplePosition);
+	// The analysis wraps from end back to start, like AudioPlayer::setLoop (so that both stay in phase)
+	void setLoop(uint32_t start, uint32_t end);
+	void clearLoop() { setLoop(0, 0); }
+	bool looping() const { return loopEnd > 0; }
+	// Moves past count chunks without analyzing them, wrapping in the loop region like the processing does
+	void skipChunks(unsigned count);
+	// For a sliding buffer (live input): the samples were moved back by frames, the analysis continues from there
+	void rebase(uint32_t frames);
+
+	// Sliding mode: for following the playback at the display rate, with the latest samples instead of those of the last
+	// hop. The window slides from where the previous call stopped to untilOffset, a quarter of inSamplesPerIteration at
+	// a time (see SlidingDft), and currentDFT() takes the strongest magnitude of each bin among these windows, like the
+	// max over the blocks of processDFTBatchAndSmooth. Full rate only (no decimation).
+	void processSlidingAndSmooth(uint32_t untilOffset, double alpha);
+	// Same as processDFTInChunksAndSmooth, but updates currentBands() (log-spaced, see MultiResolutionDft)
+	void processMultiResolutionAndSmooth(unsigned processingChunks, double alpha);
+	// Puts 2^stages decimation in front of the DFT of processDFTInChunksAndSmooth: the same DFT size then covers
+	// [0, analyzedSampleRate() / 2] with bins 2^stages times narrower (for effects that only show the lows), and each
+	// DFT window spans 2^stages chunks, so there are that many times fewer DFTs per hop
+	void setDecimationStages(unsigned stages);
+	unsigned analyzedSampleRate() const { return wavSpec.freq / decimator.factor(); }
+	const pooled_vector<double>& currentBands();
+	// Interpolated in currentBands(), from multiResolution.minFrequency (0) to the Nyquist frequency (1) on a log scale
+	double getBandInterpolated(double positionBetween0And1);
+
+	MultiResolutionDft multiResolution;
+
 private:
-	vector<double> nextValues, temp;
-	vector<double> dftOut;
+	// Start of the next chunk to analyze; moves waveBufferOffset past it, wrapping at the end of the loop region like
+	// the playback does
+	uint32_t nextChunk();
+	// Smoothing factor for this processing: 1 (no smoothing) right after a seek
+	double takeAlpha(double alpha);
+
+	// Feeds the wav samples up to untilOffset to the decimator (restarting it if we jumped), keeping the last
+	// inSamplesPerIteration decimated samples in decimatedSamples
+	void feedDecimator(uint32_t untilOffset);
+	void feedMultiResolution(uint32_t untilOffset);
+
+	pooled_vector<double> dftOut;
+	pooled_vector<double> bandsNext, bandsOut;
+	DecimatorChain decimator;
+	pooled_vector<float> monoSamples, decimatedOut, decimatedSamples;
+	pooled_vector<float> decimatedBlocks; // the decimatedSamples window after each chunk
+	SlidingDft sliding;
+	pooled_vector<double> slidingMax;
+	uint32_t decimatorOffset, multiResolutionOffset, slidingOffset;
+	uint32_t loopStart, loopEnd; // loopEnd = 0: no loop
+	bool warmUpPending;
 };
 
@@ -1,7 +1,15 @@
 #pragma once
 #include <SDL.h>
 #include <memory.h>
+#include <algorithm>
 #include <functional>
+#include <mutex>
+#include <typeindex>
+#include <optional>
+#include <vector>
+#include "BufferPool.h"
+#include "Simd.h"
+#include "Upscaler.h"
 
 struct Color {
 	float components[3];
@@ -10,7 +18,9 @@ struct Color {
 
 	Color(float r, float g, float b) : components { r, g, b } {}
 
-	Color(Uint32 sdlColor);
+	// Only meaningful for RGB surfaces. Explicit, so that an ARGB value can't silently become a color of an HSL surface
+	// (whose Uint32 overloads are deleted).
+	explicit Color(Uint32 sdlColor) : components{ float(sdlColor >> 16 & 0xff), float(sdlColor >> 8 & 0xff), float(sdlColor & 0xff) } {}
 
 	inline float& r() { return components[0]; }
 	inline float& g() { return components[1]; }
@@ -32,27 +42,98 @@ struct Color {
 	}
 };
 
-struct DrawingSurface {
-	SDL_Surface* sdlSurface;
+// What the main loop needs from the surface of an effect, whatever its pixel storage
+struct PresentableSurface {
+	SDL_Surface* sdlSurface; // same size as the surface, not owned
+
+	PresentableSurface(SDL_Surface* surface) : sdlSurface(surface) {}
+	virtual ~PresentableSurface() {}
+	virtual void blitToSdlSurface() = 0;
+	virtual bool blitScaledTo(SDL_Surface* dst) = 0;
+	// Runs the passes the effect queued (see PixelPass), for when the pixels are needed before the next present
+	virtual void flushPasses() {}
+	virtual void discardPasses() {}
+	// Switches to another SDL surface of a different size, rescaling the image; returns false if this kind of surface
+	// can't (then nothing changed). See SurfacePool::resize.
+	virtual bool resizeTo(SDL_Surface*) { return false; }
+
+	// Divisors of the window size that the ResolutionController may pick for this surface, 0 if the routine needs a
+	// fixed size (see allowDynamicResolution)
+	unsigned minDivisor = 0, maxDivisor = 0;
+
+	// Fused conversion + integer upscale when the window format allows it, else goes through sdlSurface
+	void presentTo(SDL_Surface* dst, unsigned dstW, unsigned dstH) {
+		if (blitScaledTo(dst)) return;
+		// Window surface in an exotic format, let SDL convert it
+		blitToSdlSurface();
+		SDL_Rect srcRect = { 0, 0, sdlSurface->w, sdlSurface->h };
+		SDL_Rect dstRect = { 0, 0, int(dstW), int(dstH) };
+		SDL_BlitScaled(sdlSurface, &srcRect, dst, &dstRect);
+	}
+};
+
+// A full-surface per-pixel pass (the ScreenMover/ScreenStretcher moves, a fade), queued on the surface instead of being
+// run right away: the queued passes and the conversion for display then go over the pixels in a single sweep, row by
+// row, while each row is still in cache.
+struct PixelPass {
+	enum class Kind { Move, MoveHsl, Stretch, Circular, Fade };
+
+	Kind kind;
+	int moveX = 0, moveY = 0;
+	Color fillColor;
+	float alpha; // same scale as Color::blend
+	bool expandOrContract = false;
+
+	static PixelPass move(int moveX, int moveY, Color fillColor, float alpha) { return PixelPass(Kind::Move, fillColor, alpha, moveX, moveY); }
+	static PixelPass moveHsl(int moveX, int moveY, Color fillColor, float alpha) { return PixelPass(Kind::MoveHsl, fillColor, alpha, moveX, moveY); }
+	static PixelPass stretch(Color fillColor, float alpha) { return PixelPass(Kind::Stretch, fillColor, alpha); }
+	static PixelPass circular(Color fillColor, float alpha, bool expandOrContract) {
+		PixelPass pass(Kind::Circular, fillColor, alpha);
+		pass.expandOrContract = expandOrContract;
+		return pass;
+	}
+	// Blends every pixel towards fillColor
+	static PixelPass fade(Color fillColor, float alpha) { return PixelPass(Kind::Fade, fillColor, alpha); }
+
+	// How many rows above and below a row the pass reads
+	unsigned reach() const { return kind == Kind::Fade ? 0 : 1; }
+
+private:
+	PixelPass(Kind kind, Color fillColor, float alpha, int moveX = 0, int moveY = 0) : kind(kind), moveX(moveX), moveY(moveY), fillColor(fillColor), alpha(alpha) {}
+};
+
+enum class ColorSpace { Rgb, Hsl };
+// Wrap: channels are cast to bytes as-is (fastest, the effect must stay in range), Clamp: protect against overflows
+enum class Overflow { Wrap, Clamp };
+
+// The color space and overflow policy are fixed at compile time, so each effect gets its own branch-free blit.
+template<ColorSpace Space = ColorSpace::Rgb, Overflow Policy = Overflow::Wrap>
+struct BasicDrawingSurface : PresentableSurface {
+	static constexpr bool useHsl = Space == ColorSpace::Hsl;
+	static constexpr bool protectOverflow = Policy == Overflow::Clamp;
+
 	float* pixels;
 	unsigned w, h, pitch;
-	bool protectOverflow;
-	bool useHsl; // false = rgb, true = hsl
+	// Storage position of the logical (0, 0): scroll() moves it instead of the pixels, both coordinates wrap around
+	unsigned originX = 0, originY = 0;
 
-	DrawingSurface(const DrawingSurface&) = delete; // disallowed
+	BasicDrawingSurface(const BasicDrawingSurface&) = delete; // disallowed
 
-	DrawingSurface(SDL_Surface * surface) : w(surface->w), h(surface->h), pitch(surface->pitch), sdlSurface(surface) {
+	BasicDrawingSurface(SDL_Surface * surface) : PresentableSurface(surface), w(surface->w), h(surface->h), pitch(surface->pitch) {
 		if (pitch < w * 4) throw "Error with pixel format, make sure that you use 32 bits";
-		pixels = new float[h * pitch];
-		protectOverflow = false;
-		useHsl = false;
+		pixels = BufferPool::shared().allocateArray<float>(h * pitch);
 	}
 
-	~DrawingSurface() {
-		delete[] pixels;
+	~BasicDrawingSurface() {
+		BufferPool::shared().releaseArray(pixels, h * pitch);
 	}
 
+	void clearScreen(Uint32 sdlColor) requires (!useHsl) { clearScreen(Color(sdlColor)); }
+	void clearScreen(Uint32 sdlColor) requires useHsl = delete;
 	void clearScreen(Color color) {
+		// Whatever was queued would be overwritten
+		pendingPasses.clear();
+		originX = originY = 0;
 		unsigned size = pitch * h / 4;
 		float* ptr = pixels;
 		while (size-- > 0) {
@@ -63,41 +144,95 @@ struct DrawingSurface {
 		}
 	}
 
+	// Storage of the logical pixel (x, y), which must be within the surface
+	float* pixelAt(unsigned x, unsigned y) {
+		x += originX, y += originY;
+		if (x >= w) x -= w;
+		if (y >= h) y -= h;
+		return pixels + y * pitch + x * 4;
+	}
+
+	// fn(float* ptr, unsigned count) for the storage of pixels x to x + count - 1 of row y: one span, or two when the
+	// row wraps around. Must be within the surface.
+	template<typename SpanFn>
+	void forEachSpan(unsigned x, unsigned y, unsigned count, SpanFn fn) {
+		float* ptr = pixelAt(x, y);
+		unsigned sx = x + originX < w ? x + originX : x + originX - w;
+		unsigned first = count < w - sx ? count : w - sx;
+		fn(ptr, first);
+		if (first < count) fn(ptr - sx * 4, count - first);
+	}
+
+	// Moves the image by (dx, dy) pixels (positive = right / down) by moving the origin, then fills what came in with
+	// fillColor. Only one column or row is written per pixel of scrolling, whatever the size of the surface.
+	void scroll(int dx, int dy, Color fillColor) {
+		// Queued passes were meant for the image before the scroll
+		if (!pendingPasses.empty()) flushPasses();
+		dx = std::max(-int(w), std::min(dx, int(w))), dy = std::max(-int(h), std::min(dy, int(h)));
+		originX = unsigned((int(originX) - dx + int(w)) % int(w));
+		originY = unsigned((int(originY) - dy + int(h)) % int(h));
+		if (dx > 0) fillRect(0, 0, dx, h, fillColor);
+		else if (dx < 0) fillRect(w + dx, 0, -dx, h, fillColor);
+		if (dy > 0) fillRect(0, 0, w, dy, fillColor);
+		else if (dy < 0) fillRect(0, h + dy, w, -dy, fillColor);
+	}
+
 	void setPixel(unsigned x, unsigned y, Color color) {
 		if (x >= w || y >= h) return;
 
-		float* ptr = pixels + y * pitch + x * 4;
+		float* ptr = pixelAt(x, y);
 		*ptr++ = color.components[0];
 		*ptr++ = color.components[1];
 		*ptr++ = color.components[2];
 	}
+	void setPixel(unsigned x, unsigned y, Uint32 sdlColor) requires (!useHsl) { setPixel(x, y, Color(sdlColor)); }
+	void setPixel(unsigned x, unsigned y, Uint32 sdlColor) requires useHsl = delete; // would need a RGB -> HSL conversion
 
 	Color getPixel(unsigned x, unsigned y, Color defaultColor = Color()) {
 		if (x >= w || y >= h) return defaultColor;
 
-		float* ptr = pixels + y * pitch + x * 4;
+		float* ptr = pixelAt(x, y);
 		return Color(ptr[0], ptr[1], ptr[2]);
 	}
 
+	// Clipped once, then filled row by row
 	void fillRect(unsigned x, unsigned y, unsigned w, unsigned h, Color c) {
-		for (unsigned i = 0; i < w; i++)
-			for (unsigned j = 0; j < h; j++)
-				setPixel(x + i, y + j, c);
+		if (x >= this->w || y >= this->h) return;
+		if (w > this->w - x) w = this->w - x;
+		if (h > this->h - y) h = this->h - y;
+		for (unsigned j = 0; j < h; j++) {
+			forEachSpan(x, y + j, w, [&](float* ptr, unsigned count) {
+				for (unsigned i = 0; i < count; i++, ptr += 4) {
+					ptr[0] = c.components[0], ptr[1] = c.components[1], ptr[2] = c.components[2];
+				}
+			});
+		}
+	}
+	void fillRect(unsigned x, unsigned y, unsigned w, unsigned h, Uint32 sdlColor) requires (!useHsl) { fillRect(x, y, w, h, Color(sdlColor)); }
+	void fillRect(unsigned x, unsigned y, unsigned w, unsigned h, Uint32 sdlColor) requires useHsl = delete;
+
+	// Converts row y to ARGB8888 (w pixels), applying the HSL conversion and overflow protection of this surface type
+	void convertRow(unsigned y, Uint32* dstPtr) {
+		forEachSpan(0, y, w, [&](const float* srcPtr, unsigned count) {
+			convertSpan(srcPtr, dstPtr, count);
+			dstPtr += count;
+		});
+	}
+	// Same for a row laid out like the storage (starting with the pixel at originX)
+	void convertStorageRow(const float* row, Uint32* dstPtr) {
+		convertSpan(row + originX * 4, dstPtr, w - originX);
+		if (originX) convertSpan(row, dstPtr + (w - originX), originX);
 	}
 
-	void blitToSdlSurface() {
-		float* srcPtr = pixels;
-		Uint32* dstPtr = (Uint32*)sdlSurface->pixels;
-		void* dstPtrEnd = (Uint8*)dstPtr + pitch * h;
-
-		if (useHsl) {
-			while ((void*)dstPtr < dstPtrEnd) {
-				//float h = fmodf(srcPtr[0], 1);
-				//float l = fminf(1, fmaxf(0, srcPtr[2]));
-				//float s = fminf(1, fmaxf(0, srcPtr[1]));
-				float h = protectOverflow ? fmodf(srcPtr[0], 1) : srcPtr[0];
-				float s = protectOverflow ? clamp(srcPtr[1]) : srcPtr[1];
-				float l = protectOverflow ? clamp(computeSaturatedL(srcPtr[1], srcPtr[2])) : srcPtr[2];
+	void convertSpan(const float* srcPtr, Uint32* dstPtr, unsigned count) {
+		if constexpr (useHsl) {
+			for (unsigned x = 0; x < count; x++) {
+				float h = srcPtr[0], s = srcPtr[1], l = srcPtr[2];
+				if constexpr (protectOverflow) {
+					h = fmodf(h, 1);
+					s = clamp(srcPtr[1]);
+					l = clamp(computeSaturatedL(srcPtr[1], srcPtr[2]));
+				}
 
 				float q = l < 0.5 ? l * (1 + s) : l + s - l * s;
 				float p = 2 * l - q;
@@ -108,8 +243,37 @@ struct DrawingSurface {
 				srcPtr += 4;
 			}
 		}
-		else if (protectOverflow) {
-			while ((void*)dstPtr < dstPtrEnd) {
+		else {
+			convertRgbSpan(srcPtr, dstPtr, count);
+		}
+	}
+
+	void convertRgbSpan(const float* srcPtr, Uint32* dstPtr, unsigned count) {
+		unsigned x = 0;
+#ifdef USE_SSE2
+		// 4 pixels at a time: truncate to int32, then narrow to bytes (saturating = clamped to [0, 255], or masked to
+		// the low byte like the (Uint8) cast), swapping R and B on the way to get the ARGB memory order.
+		const __m128i alpha = _mm_set1_epi32(0xff << 24), lowByte = _mm_set1_epi32(0xff);
+		for (; x + 4 <= count; x += 4) {
+			__m128i p0 = _mm_cvttps_epi32(_mm_loadu_ps(srcPtr));
+			__m128i p1 = _mm_cvttps_epi32(_mm_loadu_ps(srcPtr + 4));
+			__m128i p2 = _mm_cvttps_epi32(_mm_loadu_ps(srcPtr + 8));
+			__m128i p3 = _mm_cvttps_epi32(_mm_loadu_ps(srcPtr + 12));
+			if constexpr (!protectOverflow) {
+				p0 = _mm_and_si128(p0, lowByte), p1 = _mm_and_si128(p1, lowByte);
+				p2 = _mm_and_si128(p2, lowByte), p3 = _mm_and_si128(p3, lowByte);
+			}
+			__m128i lo = _mm_packs_epi32(p0, p1), hi = _mm_packs_epi32(p2, p3);
+			lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+			hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+			_mm_storeu_si128((__m128i*)dstPtr, _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+			dstPtr += 4;
+			srcPtr += 16;
+		}
+#endif
+
+		if constexpr (protectOverflow) {
+			for (; x < count; x++) {
 				int r = int(srcPtr[0]), g = int(srcPtr[1]), b = int(srcPtr[2]);
 				if (r < 0) r = 0; if (r > 255) r = 255;
 				if (g < 0) g = 0; if (g > 255) g = 255;
@@ -119,20 +283,263 @@ struct DrawingSurface {
 			}
 		}
 		else {
-			while ((void*)dstPtr < dstPtrEnd) {
+			for (; x < count; x++) {
 				*dstPtr++ = 0xff << 24 | (Uint8)(srcPtr[0]) << 16 | (Uint8)(srcPtr[1]) << 8 | (Uint8)(srcPtr[2]);
 				srcPtr += 4;
 			}
 		}
 	}
 
-	DrawingSurface* clone() {
-		DrawingSurface* dest = new DrawingSurface(sdlSurface);
+	void blitToSdlSurface() override {
+		PassSweep sweep(*this);
+		Uint8* dstRow = (Uint8*)sdlSurface->pixels;
+		for (unsigned y = 0; y < h; y++, dstRow += sdlSurface->pitch) {
+			sweep.finishRow(y);
+			convertRow(y, (Uint32*)dstRow);
+		}
+	}
+
+	// Converts and upscales in one pass to the window surface (no intermediate SDL surface nor SDL_BlitScaled).
+	// Returns false if the destination format is not supported, in which case use blitToSdlSurface + SDL_BlitScaled.
+	bool blitScaledTo(SDL_Surface* dst) override {
+		if (pendingPasses.empty()) {
+			return Upscaler::blitIntegerScaled(dst, w, h, [this](unsigned y, Uint32* out) { convertRow(y, out); });
+		}
+		const unsigned count = unsigned(pendingPasses.size()), threads = WorkerPool::shared().threadCount();
+		bool inBands = threads > 1 && count <= PassSweep::MAX_PASSES;
+		for (const PixelPass& pass : pendingPasses) inBands = inBands && (pass.reach() == 0 || pass.alpha <= MAX_BAND_ALPHA);
+		if (!inBands) {
+			// A single thread, or passes carrying too far down: each row goes through the queued passes right before being
+			// converted, in order on one thread
+			PassSweep sweep(*this);
+			return Upscaler::blitIntegerScaled(dst, w, h, [&](unsigned y, Uint32* out) {
+				sweep.finishRow(y);
+				convertRow(y, out);
+			}, true);
+		}
+
+		// In bands, one per thread. Each band sweeps the passes over a copy of its rows plus halo rows, and each row, once
+		// through all the passes, goes to a new buffer (the other bands still read the current one) and gets converted.
+		// Below, the halo covers what the passes read ahead. Above, a pass reads the rows it has just processed (in place,
+		// like they always did), so each row depends on all those above; but by no more than alpha / 256 per row, so
+		// BAND_WARM_UP_ROWS more rows bring the seams within rounding of the sweep of the whole surface.
+		unsigned lag[PassSweep::MAX_PASSES];
+		PassSweep::lagsOf(pendingPasses.data(), count, lag);
+		const unsigned haloAbove = lag[count - 1] + BAND_WARM_UP_ROWS, haloBelow = lag[count - 1] + 1;
+		float* nextPixels = BufferPool::shared().allocateArray<float>(h * pitch);
+		static thread_local std::optional<BandRows> band;
+		bool done = Upscaler::blitIntegerScaledInBands(dst, w, h, std::max(8u, (h + threads - 1) / threads), [&](unsigned begin, unsigned end) {
+			static thread_local std::vector<float> copy;
+			band.emplace(*this, begin > haloAbove ? begin - haloAbove : 0, std::min(h, end + haloBelow));
+			if (copy.size() < (band->bottom - band->top) * pitch) copy.resize((band->bottom - band->top) * pitch);
+			band->rows = copy.data();
+		}, [&](unsigned y, Uint32* out) {
+			band->finishRow(y, pendingPasses.data(), count, lag);
+			const float* row = band->rows + (y - band->top) * pitch;
+			memcpy(nextPixels + (storageRow(y) - pixels), row, w * 4 * sizeof(float));
+			convertStorageRow(row, out);
+		});
+		if (!done) {
+			// Nothing ran, the passes stay queued
+			BufferPool::shared().releaseArray(nextPixels, h * pitch);
+			return false;
+		}
+		BufferPool::shared().releaseArray(pixels, h * pitch);
+		pixels = nextPixels;
+		pendingPasses.clear();
+		return true;
+	}
+
+	// Runs at the next present (fused with the conversion), or before the routine draws again
+	void queuePass(const PixelPass& pass) { pendingPasses.push_back(pass); }
+	// Right away, on the whole surface
+	void applyPass(const PixelPass& pass) {
+		for (unsigned y = 0; y < h; y++) applyPassToRow(pass, y);
+	}
+	void flushPasses() override {
+		PassSweep sweep(*this);
+	}
+	void discardPasses() override { pendingPasses.clear(); }
+
+	void applyPassToRow(const PixelPass& pass, unsigned y) { applyPassToRow(*this, pass, y); }
+	// On whatever has w, h, getPixel and setPixel like the surface (e.g. the rows of a band, see BandRows)
+	template<typename Target>
+	static void applyPassToRow(Target& target, const PixelPass& pass, unsigned y) {
+		const unsigned w = target.w, h = target.h;
+		const Color fillColor = pass.fillColor;
+		const float alpha = pass.alpha;
+		switch (pass.kind) {
+		case PixelPass::Kind::Move:
+			for (unsigned x = 0; x < w; x++) {
+				Color pixel1 = target.getPixel(x, y);
+				Color pixel2 = target.getPixel(x - pass.moveX, y - pass.moveY, fillColor);
+				target.setPixel(x, y, pixel1.blend(pixel2, alpha));
+			}
+			break;
+		case PixelPass::Kind::MoveHsl:
+			for (unsigned x = 0; x < w; x++) {
+				Color pixel1 = target.getPixel(x, y);
+				Color pixel2 = target.getPixel(x - pass.moveX, y - pass.moveY, fillColor);
+				pixel2.components[0] = pixel1.components[0];
+				pixel2.components[1] = pixel1.components[1];
+				target.setPixel(x, y, pixel1.blend(pixel2, alpha).blend(Color(0, 0, 0), 2));
+			}
+			break;
+		case PixelPass::Kind::Stretch:
+			for (unsigned x = 0; x < w; x++) {
+				Color pixel1 = target.getPixel(x, y);
+				unsigned nextPixX = x < w / 2 ? (x + 1) : (x - 1);
+				unsigned nextPixY = y < h / 2 ? (y + 1) : (y - 1);
+				Color pixel2 = target.getPixel(nextPixX, nextPixY, fillColor);
+				pixel2 = pixel2.blend(fillColor, 16);
+				target.setPixel(x, y, pixel1.blend(pixel2, alpha));
+			}
+			break;
+		case PixelPass::Kind::Circular:
+			for (unsigned x = 0; x < w; x++) {
+				float xFromCenter = float(x) - w / 2, yFromCenter = h / 2 - float(y);
+				float angle = atan2f(yFromCenter, xFromCenter);
+				Color pixel1 = target.getPixel(x, y);
+				unsigned nextPixX = pass.expandOrContract ? roundf(x - 1 * cos(angle)) : roundf(x + 1 * cos(angle));
+				unsigned nextPixY = pass.expandOrContract ? roundf(y + 1 * sin(angle)) : roundf(y - 1 * sin(angle));
+				Color pixel2 = target.getPixel(nextPixX, nextPixY, fillColor);
+				pixel2 = pixel2.blend(fillColor, 16);
+				target.setPixel(x, y, pixel1.blend(pixel2, alpha));
+			}
+			break;
+		case PixelPass::Kind::Fade:
+			for (unsigned x = 0; x < w; x++) {
+				target.setPixel(x, y, target.getPixel(x, y).blend(fillColor, alpha));
+			}
+			break;
+		}
+	}
+
+	// Nearest neighbor, only when the controller changes the resolution
+	bool resizeTo(SDL_Surface* surface) override {
+		if (surface->pitch < surface->w * 4) return false;
+		flushPasses();
+		unsigned newW = surface->w, newH = surface->h, newPitch = surface->pitch;
+		float* newPixels = BufferPool::shared().allocateArray<float>(newH * newPitch);
+		for (unsigned y = 0; y < newH; y++) {
+			float* dstPtr = newPixels + y * newPitch;
+			for (unsigned x = 0; x < newW; x++, dstPtr += 4) {
+				const float* srcPtr = pixelAt(x * w / newW, y * h / newH);
+				dstPtr[0] = srcPtr[0], dstPtr[1] = srcPtr[1], dstPtr[2] = srcPtr[2];
+			}
+		}
+		BufferPool::shared().releaseArray(pixels, h * pitch);
+		pixels = newPixels;
+		w = newW, h = newH, pitch = newPitch;
+		originX = originY = 0;
+		sdlSurface = surface;
+		return true;
+	}
+
+	BasicDrawingSurface* clone() {
+		BasicDrawingSurface* dest = new BasicDrawingSurface(sdlSurface);
 		memcpy(dest->pixels, pixels, h * pitch * sizeof(float));
+		dest->originX = originX, dest->originY = originY;
 		return dest;
 	}
 
 private:
+	// Runs the queued passes row by row, each pass lagging behind the previous one by the rows they read around, so that
+	// every pass sees rows already processed by the previous ones (the same result as running each pass on the whole
+	// surface in turn). finishRow(y) must be called with increasing y; the rest is done on destruction.
+	struct PassSweep {
+		static const unsigned MAX_PASSES = 8;
+
+		// Rows by which pass i trails the first one
+		static void lagsOf(const PixelPass* passes, unsigned count, unsigned* lag) {
+			for (unsigned i = 0; i < count; i++) {
+				lag[i] = i == 0 ? 0 : lag[i - 1] + std::max(passes[i - 1].reach(), passes[i].reach());
+			}
+		}
+
+		explicit PassSweep(BasicDrawingSurface& surface) : surface(surface), count(unsigned(surface.pendingPasses.size())) {
+			if (count > MAX_PASSES) {
+				// Unlikely: run the extra ones first, on their own
+				for (unsigned i = 0; i < count - MAX_PASSES; i++) surface.applyPass(surface.pendingPasses[i]);
+				surface.pendingPasses.erase(surface.pendingPasses.begin(), surface.pendingPasses.end() - MAX_PASSES);
+				count = MAX_PASSES;
+			}
+			lagsOf(surface.pendingPasses.data(), count, lag);
+		}
+		~PassSweep() {
+			if (count > 0) finishRow(surface.h - 1);
+			surface.pendingPasses.clear();
+		}
+
+		void finishRow(unsigned row) {
+			if (count == 0) return;
+			for (; step <= row + lag[count - 1]; step++) {
+				for (unsigned i = 0; i < count; i++) {
+					if (step >= lag[i] && step - lag[i] < surface.h) surface.applyPassToRow(surface.pendingPasses[i], step - lag[i]);
+				}
+			}
+		}
+
+		BasicDrawingSurface& surface;
+		unsigned count, step = 0;
+		unsigned lag[MAX_PASSES];
+	};
+
+	// Rows [top, bottom) copied aside, so that a band can run the passes on them while the other bands read the surface;
+	// the rows outside are read from the surface as it was
+	struct BandRows {
+		BandRows(BasicDrawingSurface& surface, unsigned top, unsigned bottom)
+			: surface(surface), top(top), bottom(bottom), w(surface.w), h(surface.h), pitch(surface.pitch), originX(surface.originX) {}
+
+		BasicDrawingSurface& surface;
+		float* rows = nullptr; // laid out like the storage, row top first
+		const unsigned top, bottom;
+		// Copied, so that the compiler doesn't reload them after each write to the rows
+		const unsigned w, h, pitch, originX;
+		unsigned step = 0, copied = 0;
+
+		// Like PassSweep::finishRow, copying the rows from the surface as the first pass reaches them
+		void finishRow(unsigned y, const PixelPass* passes, unsigned count, const unsigned* lag) {
+			const unsigned rowCount = bottom - top;
+			for (; step <= y - top + lag[count - 1]; step++) {
+				// The first pass reads one row ahead
+				for (; copied < rowCount && copied <= step + 1; copied++) {
+					memcpy(rows + copied * pitch, surface.storageRow(top + copied), w * 4 * sizeof(float));
+				}
+				for (unsigned i = 0; i < count; i++) {
+					if (step >= lag[i] && step - lag[i] < rowCount) applyPassToRow(*this, passes[i], top + step - lag[i]);
+				}
+			}
+		}
+
+		float* pixelAt(unsigned x, unsigned y) {
+			x += originX;
+			if (x >= w) x -= w;
+			return rows + (y - top) * pitch + x * 4;
+		}
+		Color getPixel(unsigned x, unsigned y, Color defaultColor = Color()) {
+			if (x >= w || y >= h) return defaultColor;
+			const float* ptr = y - top < bottom - top ? pixelAt(x, y) : surface.pixelAt(x, y);
+			return Color(ptr[0], ptr[1], ptr[2]);
+		}
+		void setPixel(unsigned x, unsigned y, Color color) {
+			if (x >= w || y - top >= bottom - top) return;
+			float* ptr = pixelAt(x, y);
+			ptr[0] = color.components[0], ptr[1] = color.components[1], ptr[2] = color.components[2];
+		}
+	};
+	// Bands are only used when the passes that read other rows keep at most this alpha (see blitScaledTo)
+	static constexpr float MAX_BAND_ALPHA = 64;
+	static const unsigned BAND_WARM_UP_ROWS = 8;
+
+	float* storageRow(unsigned y) {
+		y += originY;
+		if (y >= h) y -= h;
+		return pixels + y * pitch;
+	}
+
+	std::vector<PixelPass> pendingPasses;
+
 	static float hue2rgb(float p, float q, float t) {
 		if (t < 0)
 			t += 1;
@@ -168,22 +575,130 @@ private:
 	}
 };
 
-extern SDL_Surface* g_sdlSurface;
-extern DrawingSurface* g_drawingSurface;
+using DrawingSurface = BasicDrawingSurface<ColorSpace::Rgb, Overflow::Wrap>;
+using ClampedDrawingSurface = BasicDrawingSurface<ColorSpace::Rgb, Overflow::Clamp>;
+using HslDrawingSurface = BasicDrawingSurface<ColorSpace::Hsl, Overflow::Clamp>;
+
 extern SDL_Window* window;
 static unsigned SCREEN_WIDTH = 240 * 3, SCREEN_HEIGHT = 160 * 3;
 
 static inline unsigned operator"" _X(unsigned long long val) { return unsigned(val); }
 
-static DrawingSurface& createDrawingSurface(unsigned width, unsigned height, unsigned desiredScaling) {
+// Keeps the surfaces (and their SDL surface) of the routines that ended, by type and size, so that switching routines
+// doesn't allocate once each kind of surface has been used.
+struct SurfacePool {
+	template<typename Surface>
+	Surface* acquire(unsigned width, unsigned height) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& slot : slots) {
+			if (!slot.inUse && slot.type == std::type_index(typeid(Surface)) && slot.w == width && slot.h == height) {
+				slot.inUse = true;
+				return static_cast<Surface*>(slot.surface);
+			}
+		}
+		Surface* surface = new Surface(takeSdlSurface(width, height));
+		slots.push_back(Slot{ std::type_index(typeid(Surface)), width, height, surface, true });
+		return surface;
+	}
+
+	void release(PresentableSurface* surface) {
+		surface->discardPasses();
+		surface->minDivisor = surface->maxDivisor = 0;
+		unsigned width = 0, height = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto& slot : slots) {
+				if (slot.surface == surface) slot.inUse = false, width = slot.w, height = slot.h;
+			}
+		}
+		// Back to the size it is pooled under
+		if (width && (unsigned(surface->sdlSurface->w) != width || unsigned(surface->sdlSurface->h) != height)) resize(surface, width, height);
+	}
+
+	// Gives the surface another size, the SDL surfaces being pooled too. Returns false if this kind of surface can't.
+	bool resize(PresentableSurface* surface, unsigned width, unsigned height) {
+		SDL_Surface* previous = surface->sdlSurface;
+		SDL_Surface* next;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			next = takeSdlSurface(width, height);
+		}
+		bool resized = surface->resizeTo(next);
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& slot : sdlSlots) {
+			if (slot.surface == (resized ? previous : next)) slot.inUse = false;
+		}
+		return resized;
+	}
+
+	// The surfaces release their pixels to the BufferPool when the pool is destroyed: constructing it first makes sure
+	// it is destroyed after this one (function-local statics go in reverse order of construction)
+	SurfacePool() { BufferPool::shared(); }
+	SurfacePool(const SurfacePool&) = delete; // disallowed
+
+	~SurfacePool() {
+		for (auto& slot : slots) delete slot.surface;
+		for (auto& slot : sdlSlots) SDL_FreeSurface(slot.surface);
+	}
+
+	static SurfacePool& shared() {
+		static SurfacePool pool;
+		return pool;
+	}
+
+private:
+	struct Slot {
+		std::type_index type;
+		unsigned w, h;
+		PresentableSurface* surface;
+		bool inUse;
+	};
+	struct SdlSlot {
+		SDL_Surface* surface;
+		bool inUse;
+	};
+
+	// With the mutex held
+	SDL_Surface* takeSdlSurface(unsigned width, unsigned height) {
+		for (auto& slot : sdlSlots) {
+			if (!slot.inUse && unsigned(slot.surface->w) == width && unsigned(slot.surface->h) == height) {
+				slot.inUse = true;
+				return slot.surface;
+			}
+		}
+		SDL_Surface* surface = SDL_CreateRGBSurface(0, width, height, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
+		sdlSlots.push_back(SdlSlot{ surface, true });
+		return surface;
+	}
+
+	std::vector<Slot> slots;
+	std::vector<SdlSlot> sdlSlots;
+	std::mutex mutex;
+};
+
+// Set by the FrameScheduler while a routine runs: the surface that createDrawingSurface made for it goes there, and
+// returns to the SurfacePool once the routine is destroyed.
+extern thread_local PresentableSurface** g_routineSurfaceSlot;
+
+// Surface can be one of the BasicDrawingSurface above (float) or PackedDrawingSurface (ARGB8888, see DrawingPacked.h)
+template<typename Surface = DrawingSurface>
+static Surface& createDrawingSurface(unsigned width, unsigned height, unsigned desiredScaling) {
 	SCREEN_WIDTH = width * desiredScaling;
 	SCREEN_HEIGHT = height * desiredScaling;
 	SDL_SetWindowSize(window, SCREEN_WIDTH, SCREEN_HEIGHT);
-	if (g_sdlSurface) SDL_FreeSurface(g_sdlSurface);
-	if (g_drawingSurface) delete g_drawingSurface;
-	g_sdlSurface = SDL_CreateRGBSurface(0, width, height, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
-	g_drawingSurface = new DrawingSurface(g_sdlSurface);
-	return *g_drawingSurface;
+	Surface* surface = SurfacePool::shared().acquire<Surface>(width, height);
+	if (g_routineSurfaceSlot) {
+		if (*g_routineSurfaceSlot) SurfacePool::shared().release(*g_routineSurfaceSlot);
+		*g_routineSurfaceSlot = surface;
+	}
+	return *surface;
+}
+
+// Lets the ResolutionController pick the size of the surface among the window size divided by minDivisor to
+// maxDivisor (e.g. 2_X to 4_X). The routine must then draw relative to w and h, which may change between two resumes.
+static void allowDynamicResolution(PresentableSurface& surface, unsigned minDivisor, unsigned maxDivisor) {
+	surface.minDivisor = minDivisor;
+	surface.maxDivisor = maxDivisor;
 }
 
 template<typename T>
@@ -193,7 +708,7 @@ static T clamp(T value, T min, T max) {
 	return value;
 }
 
-// Can only be used if the DrawingSurface::useHsl is set to false
+// Can only be used with RGB surfaces
 static Uint32 RGBA(int r, int g, int b, int a) {
 	if (r < 0) r = 0;
 	else if (r > 255) r = 255;
@@ -227,6 +742,8 @@ static Uint32 HSV(float H, float S, float V) {
 	return RGB(int((r + m) * 255), int((g + m) * 255), int((b + m) * 255));
 }
 
+// The moves are queued on the surface (see PixelPass): they run during the next present, in the same sweep as the
+// conversion for display, so call them once the frame is drawn.
 struct ScreenMover {
 	double positionX = 0, positionY = 0;
 
@@ -234,34 +751,18 @@ struct ScreenMover {
 		positionX += deltaX, positionY += deltaY;
 	}
 
-	void performMove(DrawingSurface& ds, Color fillColor, float alpha = 16) {
+	template<typename Surface>
+	void performMove(Surface& ds, Color fillColor, float alpha = 16) {
 		int moveX = int(clamp(positionX, -1.0, +1.0)), moveY = int(clamp(positionY, -1.0, +1.0));
 		positionX -= moveX, positionY -= moveY;
-		if (moveX || moveY) {
-			for (unsigned y = 0; y < unsigned(ds.h); y++) {
-				for (unsigned x = 0; x < unsigned(ds.w); x++) {
-					Color pixel1 = ds.getPixel(x, y);
-					Color pixel2 = ds.getPixel(x - moveX, y - moveY, fillColor);
-					ds.setPixel(x, y, pixel1.blend(pixel2, alpha));
-				}
-			}
-		}
+		if (moveX || moveY) ds.queuePass(PixelPass::move(moveX, moveY, fillColor, alpha));
 	}
 
-	void performMoveInHSLMode(DrawingSurface& ds, Color fillColor, float alpha = 16) {
+	template<typename Surface>
+	void performMoveInHSLMode(Surface& ds, Color fillColor, float alpha = 16) {
 		int moveX = int(clamp(positionX, -1.0, +1.0)), moveY = int(clamp(positionY, -1.0, +1.0));
 		positionX -= moveX, positionY -= moveY;
-		if (moveX || moveY) {
-			for (unsigned y = 0; y < unsigned(ds.h); y++) {
-				for (unsigned x = 0; x < unsigned(ds.w); x++) {
-					Color pixel1 = ds.getPixel(x, y);
-					Color pixel2 = ds.getPixel(x - moveX, y - moveY, fillColor);
-					pixel2.components[0] = pixel1.components[0];
-					pixel2.components[1] = pixel1.components[1];
-					ds.setPixel(x, y, pixel1.blend(pixel2, alpha).blend(Color(0, 0, 0), 2));
-				}
-			}
-		}
+		if (moveX || moveY) ds.queuePass(PixelPass::moveHsl(moveX, moveY, fillColor, alpha));
 	}
 };
 
@@ -272,47 +773,17 @@ struct ScreenStretcher {
 		move += delta;
 	}
 
-	void performStretch(DrawingSurface& ds, Color fillColor, float alpha = 16) {
+	template<typename Surface>
+	void performStretch(Surface& ds, Color fillColor, float alpha = 16) {
 		int moveInt = int(clamp(move, -1.0, +1.0));
 		move -= moveInt;
-		if (moveInt) {
-			unsigned w(ds.w), h(ds.h);
-			for (unsigned y = 0; y < h; y++) {
-				for (unsigned x = 0; x < w; x++) {
-					Color pixel1 = ds.getPixel(x, y);
-					unsigned nextPixX = x < w / 2 ? (x + 1) : (x - 1);
-					unsigned nextPixY = y < h / 2 ? (y + 1) : (y - 1);
-					Color pixel2 = ds.getPixel(nextPixX, nextPixY, fillColor);
-					//if (x == w / 2 || y == h / 2) pixel2 = pixel2.blend(fillColor, 60);
-					pixel2 = pixel2.blend(fillColor, 16);
-					//pixel2 = pixel2.subtract(Color(4, 4, 4));
-					ds.setPixel(x, y, pixel1.blend(pixel2, alpha));
-				}
-			}
-		}
+		if (moveInt) ds.queuePass(PixelPass::stretch(fillColor, alpha));
 	}
 
-	void performCircular(DrawingSurface& ds, Color fillColor, float alpha = 16, bool expandOrContract = false) {
+	template<typename Surface>
+	void performCircular(Surface& ds, Color fillColor, float alpha = 16, bool expandOrContract = false) {
 		int moveInt = int(clamp(move, -1.0, +1.0));
 		move -= moveInt;
-		if (moveInt) {
-			auto copy = ds.clone();
-			unsigned w(ds.w), h(ds.h);
-			for (unsigned y = 0; y < h; y++) {
-				for (unsigned x = 0; x < w; x++) {
-					float xFromCenter = float(x) - w / 2, yFromCenter = h / 2 - float(y);
-					float angle = atan2f(yFromCenter, xFromCenter);
-					Color pixel1 = ds.getPixel(x, y);
-					unsigned nextPixX = expandOrContract ? roundf(x - 1 * cos(angle)) : roundf(x + 1 * cos(angle));
-					unsigned nextPixY = expandOrContract ? roundf(y + 1 * sin(angle)) : roundf(y - 1 * sin(angle));
-					Color pixel2 = ds.getPixel(nextPixX, nextPixY, fillColor);
-					//if (x == w / 2 || y == h / 2) pixel2 = pixel2.blend(fillColor, 60);
-					pixel2 = pixel2.blend(fillColor, 16);
-					//pixel2 = pixel2.subtract(Color(4, 4, 4));
-					ds.setPixel(x, y, pixel1.blend(pixel2, alpha));
-				}
-			}
-			delete copy;
-		}
+		if (moveInt) ds.queuePass(PixelPass::circular(fillColor, alpha, expandOrContract));
 	}
 };
@@ -0,0 +1,141 @@
+#pragma once
+#include <algorithm>
+#include "DrawingFloat.h"
+
+// Same drawing API as DrawingSurface, but pixels are stored directly as ARGB8888 (4 bytes instead of 16 per pixel).
+// Channels are always saturated to [0, 255] (like protectOverflow = true), there is no HSL mode.
+// Presenting it is just a copy of each row, so prefer it for the RGB effects that don't accumulate tiny increments.
+struct PackedDrawingSurface : PresentableSurface {
+	Uint32* pixels;
+	unsigned w, h, pitch; // pitch in pixels
+	static constexpr bool protectOverflow = true;
+
+	PackedDrawingSurface(const PackedDrawingSurface&) = delete; // disallowed
+
+	PackedDrawingSurface(SDL_Surface* surface) : PresentableSurface(surface), w(surface->w), h(surface->h), pitch(surface->pitch / 4) {
+		if (pitch < w) throw "Error with pixel format, make sure that you use 32 bits";
+		pixels = BufferPool::shared().allocateArray<Uint32>(h * pitch);
+	}
+
+	~PackedDrawingSurface() {
+		BufferPool::shared().releaseArray(pixels, h * pitch);
+	}
+
+	static inline Uint32 pack(Color color) {
+		return 0xff << 24 | saturate(color.components[0]) << 16 | saturate(color.components[1]) << 8 | saturate(color.components[2]);
+	}
+
+	static inline Color unpack(Uint32 pixel) {
+		return Color(float(pixel >> 16 & 0xff), float(pixel >> 8 & 0xff), float(pixel & 0xff));
+	}
+
+	// alpha in [0, 256], same scale as Color::blend
+	static inline Uint32 blend(Uint32 pixel1, Uint32 pixel2, unsigned alphaPixel2 = 128) {
+		const Uint32 alphaPixel1 = 256 - alphaPixel2;
+		Uint32 rb = ((pixel1 & 0xff00ff) * alphaPixel1 + (pixel2 & 0xff00ff) * alphaPixel2) >> 8 & 0xff00ff;
+		Uint32 g = ((pixel1 & 0xff00) * alphaPixel1 + (pixel2 & 0xff00) * alphaPixel2) >> 8 & 0xff00;
+		return 0xff << 24 | rb | g;
+	}
+
+	static inline Uint32 addSaturated(Uint32 pixel1, Uint32 pixel2) {
+		Uint32 r = (pixel1 >> 16 & 0xff) + (pixel2 >> 16 & 0xff), g = (pixel1 >> 8 & 0xff) + (pixel2 >> 8 & 0xff), b = (pixel1 & 0xff) + (pixel2 & 0xff);
+		return 0xff << 24 | (r > 255 ? 255 : r) << 16 | (g > 255 ? 255 : g) << 8 | (b > 255 ? 255 : b);
+	}
+
+	void clearScreen(Uint32 color) {
+		color |= 0xff << 24;
+		for (unsigned y = 0; y < h; y++) {
+			std::fill_n(pixels + y * pitch, w, color);
+		}
+	}
+	void clearScreen(Color color) { clearScreen(pack(color)); }
+
+	void setPixel(unsigned x, unsigned y, Uint32 color) {
+		if (x >= w || y >= h) return;
+		pixels[y * pitch + x] = color | 0xff << 24;
+	}
+	void setPixel(unsigned x, unsigned y, Color color) {
+		if (x >= w || y >= h) return;
+		pixels[y * pitch + x] = pack(color);
+	}
+
+	Uint32 getPackedPixel(unsigned x, unsigned y, Uint32 defaultColor = 0xff << 24) {
+		if (x >= w || y >= h) return defaultColor;
+		return pixels[y * pitch + x];
+	}
+
+	Color getPixel(unsigned x, unsigned y, Color defaultColor = Color()) {
+		if (x >= w || y >= h) return defaultColor;
+		return unpack(pixels[y * pitch + x]);
+	}
+
+	// Clipped once, then filled row by row
+	void fillRect(unsigned x, unsigned y, unsigned w, unsigned h, Uint32 color) {
+		if (x >= this->w || y >= this->h) return;
+		if (w > this->w - x) w = this->w - x;
+		if (h > this->h - y) h = this->h - y;
+		color |= 0xff << 24;
+		for (unsigned j = 0; j < h; j++) {
+			std::fill_n(pixels + (y + j) * pitch + x, w, color);
+		}
+	}
+	void fillRect(unsigned x, unsigned y, unsigned w, unsigned h, Color c) { fillRect(x, y, w, h, pack(c)); }
+
+	void convertRow(unsigned y, Uint32* dstPtr) {
+		memcpy(dstPtr, pixels + y * pitch, w * sizeof(Uint32));
+	}
+
+	void blitToSdlSurface() override {
+		Uint8* dstRow = (Uint8*)sdlSurface->pixels;
+		for (unsigned y = 0; y < h; y++, dstRow += sdlSurface->pitch) {
+			convertRow(y, (Uint32*)dstRow);
+		}
+	}
+
+	bool blitScaledTo(SDL_Surface* dst) override {
+		return Upscaler::blitIntegerScaled(dst, w, h, [this](unsigned y, Uint32* out) { convertRow(y, out); });
+	}
+
+	PackedDrawingSurface* clone() {
+		PackedDrawingSurface* dest = new PackedDrawingSurface(sdlSurface);
+		memcpy(dest->pixels, pixels, h * pitch * sizeof(Uint32));
+		return dest;
+	}
+
+private:
+	static inline Uint32 saturate(float v) {
+		int i = int(v);
+		if (i < 0) return 0;
+		if (i > 255) return 255;
+		return Uint32(i);
+	}
+};
+
+// Horizontal gradients rendered once, one per row of the cache (a bar), in the format of the packed surface. For bars
+// whose colors only depend on the position: drawing one is then a copy of the start of its gradient, then a fill.
+struct GradientSpanCache {
+	unsigned rows = 0, length = 0;
+
+	// colorAt(row, x) returns the Uint32 color of the lit cell; evaluated once per cell, here
+	template<typename ColorFn>
+	void build(unsigned rowCount, unsigned rowLength, ColorFn colorAt) {
+		rows = rowCount, length = rowLength;
+		spans.resize(size_t(rows) * length);
+		for (unsigned r = 0; r < rows; r++) {
+			for (unsigned x = 0; x < length; x++) spans[size_t(r) * length + x] = colorAt(r, x) | 0xff << 24;
+		}
+	}
+
+	// Row y of the surface from x: the first lit pixels of gradient row, then unlit up to the length of the gradient
+	void drawSpan(PackedDrawingSurface& ds, unsigned row, unsigned x, unsigned y, unsigned lit, Uint32 unlit) const {
+		if (x >= ds.w || y >= ds.h || row >= rows) return;
+		unsigned count = std::min(length, ds.w - x);
+		lit = std::min(lit, count);
+		Uint32* dst = ds.pixels + y * ds.pitch + x;
+		memcpy(dst, spans.data() + size_t(row) * length, lit * sizeof(Uint32));
+		std::fill_n(dst + lit, count - lit, unlit | 0xff << 24);
+	}
+
+private:
+	pooled_vector<Uint32> spans;
+};
@@ -0,0 +1,129 @@
+#include "Features.h"
+#include <math.h>
+
+static const double LOWEST_BAND_FREQUENCY = 40;
+static const double ONSET_MIN_FLUX = 0.5; // dB, below that it's noise whatever the statistics say
+static const double ONSET_MIN_INTERVAL = 0.1; // s
+static const double FLUX_STATS_TIME = 1; // s, time constant of the flux mean and variance
+static const double TEMPO_MEMORY = 4; // s, time constant of the autocorrelation
+static const double MIN_BPM = 50, MAX_BPM = 200, PREFERRED_BPM = 120;
+
+// Power average of dB values
+static double averageDecibels(const double* values, unsigned first, unsigned last) {
+	double power = 0;
+	for (unsigned i = first; i <= last; i++) power += pow(10, values[i] / 10);
+	return 10 * log10(power / (last - first + 1));
+}
+
+void FeatureExtractor::reset() {
+	unsigned hop = features.hop;
+	features = AudioFeatures();
+	features.hop = hop;
+	previous.clear();
+	fluxMean = fluxVariance = sinceOnset = 0;
+	tempoHopSeconds = 0;
+}
+
+void FeatureExtractor::mapBands(unsigned count, double minFrequency, double maxFrequency, bool logSpaced) {
+	mappedCount = count;
+	mappedMin = minFrequency;
+	mappedMax = maxFrequency;
+	mappedLog = logSpaced;
+
+	auto binOf = [&](double frequency) {
+		double position = logSpaced ? log(frequency / minFrequency) / log(maxFrequency / minFrequency) : (frequency - minFrequency) / (maxFrequency - minFrequency);
+		return fmin(fmax(position, 0), 1) * (count - 1);
+	};
+	for (unsigned b = 0; b < AudioFeatures::BANDS; b++) {
+		// Octaves, the last one going up to the end of the spectrum
+		double low = LOWEST_BAND_FREQUENCY * pow(2, b), high = b + 1 < AudioFeatures::BANDS ? low * 2 : maxFrequency;
+		firstBin[b] = unsigned(ceil(binOf(low)));
+		lastBin[b] = unsigned(floor(binOf(high)));
+		// Narrower than a bin (the lows of a short linear DFT): the nearest one
+		if (firstBin[b] > lastBin[b]) firstBin[b] = lastBin[b] = unsigned(round(binOf(sqrt(low * high))));
+	}
+}
+
+void FeatureExtractor::update(const double* spectrumDb, unsigned count, double minFrequency, double maxFrequency, bool logSpaced, double hopSeconds) {
+	if (count != mappedCount || minFrequency != mappedMin || maxFrequency != mappedMax || logSpaced != mappedLog) {
+		mapBands(count, minFrequency, maxFrequency, logSpaced);
+		previous.clear();
+	}
+
+	features.hop += 1;
+	features.level = float(averageDecibels(spectrumDb, 0, count - 1));
+	for (unsigned b = 0; b < AudioFeatures::BANDS; b++) {
+		features.bands[b] = float(averageDecibels(spectrumDb, firstBin[b], lastBin[b]));
+	}
+
+	// Spectral flux: only what rose counts (a note starting, not one fading)
+	double flux = 0;
+	if (previous.size() == count) {
+		for (unsigned i = 0; i < count; i++) flux += fmax(0, spectrumDb[i] - previous[i]);
+		flux /= count;
+	}
+	previous.assign(spectrumDb, spectrumDb + count);
+	features.flux = float(flux);
+
+	// Onset: the flux well above its recent statistics, not too soon after the previous one
+	const double deviation = sqrt(fluxVariance);
+	sinceOnset += hopSeconds;
+	features.onset = flux > ONSET_MIN_FLUX && flux > fluxMean + 2 * deviation && sinceOnset >= ONSET_MIN_INTERVAL;
+	if (features.onset) sinceOnset = 0;
+	const double onsetStrength = fmax(0, flux - fluxMean);
+	const double statsRate = fmin(1, hopSeconds / FLUX_STATS_TIME);
+	fluxVariance = (1 - statsRate) * (fluxVariance + statsRate * (flux - fluxMean) * (flux - fluxMean));
+	fluxMean += statsRate * (flux - fluxMean);
+
+	updateTempo(onsetStrength, hopSeconds);
+}
+
+void FeatureExtractor::updateTempo(double onsetStrength, double hopSeconds) {
+	features.beat = false;
+	// The lags are in hops: start over if the hop length changed (other effect)
+	if (hopSeconds != tempoHopSeconds) {
+		tempoHopSeconds = hopSeconds;
+		minLag = unsigned(ceil(60 / MAX_BPM / hopSeconds));
+		const unsigned maxLag = unsigned(floor(60 / MIN_BPM / hopSeconds)) + 1;
+		strengths.assign(maxLag + 1, 0);
+		autocorrelation.assign(maxLag + 1, 0);
+		strengthIndex = 0;
+		features.tempo = features.tempoConfidence = features.beatPhase = 0;
+	}
+
+	// acf[lag] += strength(now) × strength(now - lag), with the old products fading out
+	const unsigned size = unsigned(strengths.size());
+	const double decay = exp(-hopSeconds / TEMPO_MEMORY);
+	strengthIndex = (strengthIndex + 1) % size;
+	strengths[strengthIndex] = onsetStrength;
+	for (unsigned lag = 0; lag < size; lag++) {
+		autocorrelation[lag] = decay * autocorrelation[lag] + onsetStrength * strengths[(strengthIndex + size - lag) % size];
+	}
+
+	// Best period, favoring those around PREFERRED_BPM so that half and double tempos lose
+	unsigned best = 0;
+	double bestScore = 0;
+	for (unsigned lag = minLag; lag + 1 < size; lag++) {
+		double octaves = log2(60 / (lag * hopSeconds) / PREFERRED_BPM);
+		double score = autocorrelation[lag] * exp(-0.5 * octaves * octaves);
+		if (score > bestScore) {
+			bestScore = score;
+			best = lag;
+		}
+	}
+	if (best == 0 || autocorrelation[0] <= 0) return;
+
+	// Between two lags: top of the parabola through the neighbors
+	double left = autocorrelation[best - 1], center = autocorrelation[best], right = autocorrelation[best + 1];
+	double curvature = left - 2 * center + right;
+	double period = (best + (curvature < 0 ? 0.5 * (left - right) / curvature : 0)) * hopSeconds;
+	features.tempo = float(60 / period);
+	features.tempoConfidence = float(fmin(1, center / autocorrelation[0]));
+
+	// The phase runs at the tempo, and is pulled a bit towards each onset (which should fall on 0)
+	double phase = features.beatPhase + hopSeconds / period;
+	features.beat = phase >= 1;
+	phase -= floor(phase);
+	if (features.onset) phase -= 0.2 * (phase < 0.5 ? phase : phase - 1);
+	features.beatPhase = float(phase - floor(phase));
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+// What effects usually derive from the spectrum, computed once per analysis hop. Levels are in dB like currentDFT(),
+// so that they go through DftProcessor::convertPointToDecibels with the sensitivity of the effect.
+struct AudioFeatures {
+	static const unsigned BANDS = 8; // log-spaced octaves from 40 Hz
+
+	float level = -100;		// whole spectrum (same as currentDFT()[0] in volume-only mode)
+	float bands[BANDS] = { -100, -100, -100, -100, -100, -100, -100, -100 };
+	float flux = 0;			// average rise of the bins since the previous hop, in dB
+	bool onset = false;		// flux peak: something was hit during this hop
+	bool beat = false;		// on the estimated tempo grid (predicted, so also between onsets)
+	float beatPhase = 0;	// [0, 1) within the current beat
+	float tempo = 0;		// in BPM, 0 until there's enough history
+	float tempoConfidence = 0;	// [0, 1]
+	uint32_t hop = 0;		// increments with each update
+};
+
+// Incremental: each update only looks at the new spectrum, plus one autocorrelation accumulator per candidate beat
+// period for the tempo.
+struct FeatureExtractor {
+	// spectrumDb: count values from minFrequency to maxFrequency, linearly spaced (like currentDFT(), minFrequency = 0)
+	// or log-spaced (like currentBands()). hopSeconds: audio time since the previous update.
+	void update(const double* spectrumDb, unsigned count, double minFrequency, double maxFrequency, bool logSpaced, double hopSeconds);
+	// E.g. after a seek: no flux against the spectrum from before, and the tempo is estimated again
+	void reset();
+
+	const AudioFeatures& current() const { return features; }
+
+private:
+	void mapBands(unsigned count, double minFrequency, double maxFrequency, bool logSpaced);
+	void updateTempo(double onsetStrength, double hopSeconds);
+
+	AudioFeatures features;
+	// Bins of each band, for the layout they were computed for
+	unsigned firstBin[AudioFeatures::BANDS], lastBin[AudioFeatures::BANDS];
+	unsigned mappedCount = 0;
+	double mappedMin = 0, mappedMax = 0;
+	bool mappedLog = false;
+
+	std::vector<double> previous;
+	double fluxMean = 0, fluxVariance = 0, sinceOnset = 0;
+	// Onset strength history (ring) and its decaying autocorrelation, one entry per lag in hops
+	std::vector<double> strengths, autocorrelation;
+	unsigned strengthIndex = 0, minLag = 0;
+	double tempoHopSeconds = 0;
+};
@@ -0,0 +1,98 @@
+#pragma once
+#include <math.h>
+#include <utility>
+#include "DrawingFloat.h"
+
+// Anti-aliased lines (Xiaolin Wu) on the float surfaces. Each pixel receives color × coverage, either added to what's
+// already there (glow, needs a clamped surface) or alpha-blended over it.
+enum class LineBlend { Additive, Alpha };
+
+namespace LinesDetail {
+	template<LineBlend Blend, typename Surface>
+	static inline void plot(Surface& ds, int x, int y, const Color& color, float coverage) {
+		if (unsigned(x) >= ds.w || unsigned(y) >= ds.h) return;
+		float* ptr = ds.pixelAt(unsigned(x), unsigned(y));
+		if constexpr (Blend == LineBlend::Additive) {
+			ptr[0] += color.components[0] * coverage;
+			ptr[1] += color.components[1] * coverage;
+			ptr[2] += color.components[2] * coverage;
+		}
+		else {
+			ptr[0] += (color.components[0] - ptr[0]) * coverage;
+			ptr[1] += (color.components[1] - ptr[1]) * coverage;
+			ptr[2] += (color.components[2] - ptr[2]) * coverage;
+		}
+	}
+
+	template<LineBlend Blend, bool Steep, typename Surface>
+	static inline void plotPair(Surface& ds, int major, float minor, const Color& color, float coverage) {
+		int minorInt = int(floorf(minor));
+		float fraction = minor - minorInt;
+		if constexpr (Steep) {
+			plot<Blend>(ds, minorInt, major, color, (1 - fraction) * coverage);
+			plot<Blend>(ds, minorInt + 1, major, color, fraction * coverage);
+		}
+		else {
+			plot<Blend>(ds, major, minorInt, color, (1 - fraction) * coverage);
+			plot<Blend>(ds, major, minorInt + 1, color, fraction * coverage);
+		}
+	}
+
+	// Coordinates are already swapped so that x is the major axis and x0 <= x1
+	template<LineBlend Blend, bool Steep, typename Surface>
+	static void drawSpan(Surface& ds, float x0, float y0, float x1, float y1, const Color& color, float opacity, bool plotStart, bool plotEnd) {
+		float dx = x1 - x0, dy = y1 - y0;
+		float gradient = dx < 1e-6f ? 1 : dy / dx;
+
+		float xEnd = floorf(x0 + 0.5f);
+		float yEnd = y0 + gradient * (xEnd - x0);
+		float xGap = 1 - (x0 + 0.5f - floorf(x0 + 0.5f));
+		const int xStart = int(xEnd);
+		if (plotStart) plotPair<Blend, Steep>(ds, xStart, yEnd, color, xGap * opacity);
+		float intery = yEnd + gradient;
+
+		xEnd = floorf(x1 + 0.5f);
+		yEnd = y1 + gradient * (xEnd - x1);
+		xGap = x1 + 0.5f - floorf(x1 + 0.5f);
+		const int xStop = int(xEnd);
+		if (plotEnd && xStop != xStart) plotPair<Blend, Steep>(ds, xStop, yEnd, color, xGap * opacity);
+
+		// Skip the part of the span that can't touch the surface
+		int first = xStart + 1, last = xStop - 1;
+		const int majorSize = int(Steep ? ds.h : ds.w);
+		if (first < 0) {
+			intery += gradient * float(-first);
+			first = 0;
+		}
+		if (last > majorSize - 1) last = majorSize - 1;
+		for (int x = first; x <= last; x++) {
+			plotPair<Blend, Steep>(ds, x, intery, color, opacity);
+			intery += gradient;
+		}
+	}
+}
+
+// plotEnd = false leaves out the last endpoint, so that consecutive segments of a polyline don't cover it twice
+template<LineBlend Blend, typename Surface>
+static void drawLineAA(Surface& ds, float x0, float y0, float x1, float y1, Color color, float opacity = 1, bool plotEnd = true) {
+	bool plotStart = true;
+	const bool steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+	if (steep) {
+		std::swap(x0, y0);
+		std::swap(x1, y1);
+	}
+	if (x0 > x1) {
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+		std::swap(plotStart, plotEnd);
+	}
+	if (steep) LinesDetail::drawSpan<Blend, true>(ds, x0, y0, x1, y1, color, opacity, plotStart, plotEnd);
+	else LinesDetail::drawSpan<Blend, false>(ds, x0, y0, x1, y1, color, opacity, plotStart, plotEnd);
+}
+
+template<LineBlend Blend, typename Surface>
+static void drawPolylineAA(Surface& ds, const float* xs, const float* ys, unsigned count, Color color, float opacity = 1) {
+	for (unsigned i = 0; i + 1 < count; i++) {
+		drawLineAA<Blend>(ds, xs[i], ys[i], xs[i + 1], ys[i + 1], color, opacity, i + 2 == count);
+	}
+}
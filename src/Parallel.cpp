@@ -0,0 +1,81 @@
+#include "Parallel.h"
+
+static thread_local bool t_insideJob = false;
+
+WorkerPool::WorkerPool(unsigned threadCount) {
+	// The submitting thread counts as one worker
+	for (unsigned i = 1; i < threadCount; i++) {
+		threads.emplace_back([this] { workerLoop(); });
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quitting = true;
+	}
+	wakeUp.notify_all();
+	for (auto& thread : threads) thread.join();
+}
+
+WorkerPool& WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
+
+void WorkerPool::parallelFor(unsigned count, unsigned minChunk, const std::function<void(unsigned, unsigned)>& fn) {
+	if (minChunk == 0) minChunk = 1;
+	if (t_insideJob || threads.empty() || count <= minChunk) {
+		fn(0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> submitLock(submitMutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		unsigned chunks = threadCount() * 2;
+		job = &fn;
+		jobCount = count;
+		jobChunk = (count + chunks - 1) / chunks;
+		if (jobChunk < minChunk) jobChunk = minChunk;
+		nextChunk = 0;
+		busyWorkers = unsigned(threads.size());
+		generation++;
+	}
+	wakeUp.notify_all();
+
+	t_insideJob = true;
+	runChunks();
+	t_insideJob = false;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this] { return busyWorkers == 0; });
+	job = nullptr;
+}
+
+void WorkerPool::runChunks() {
+	while (true) {
+		unsigned begin = nextChunk.fetch_add(jobChunk);
+		if (begin >= jobCount) return;
+		unsigned end = begin + jobChunk < jobCount ? begin + jobChunk : jobCount;
+		(*job)(begin, end);
+	}
+}
+
+void WorkerPool::workerLoop() {
+	uint64_t seenGeneration = 0;
+	t_insideJob = true;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [&] { return quitting || generation != seenGeneration; });
+			if (quitting) return;
+			seenGeneration = generation;
+		}
+
+		runChunks();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0) finished.notify_one();
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <stdint.h>
+
+// Persistent set of worker threads used to split per-frame work (rows, tiles…) across cores.
+// The calling thread takes part in the work, and nested calls from inside a job run serially.
+struct WorkerPool {
+	explicit WorkerPool(unsigned threadCount = std::thread::hardware_concurrency());
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete; // disallowed
+
+	// Calls fn(begin, end) on ranges covering [0, count), each at least minChunk long. Returns when all are done.
+	void parallelFor(unsigned count, unsigned minChunk, const std::function<void(unsigned begin, unsigned end)>& fn);
+	unsigned threadCount() const { return unsigned(threads.size()) + 1; }
+
+	static WorkerPool& shared();
+
+private:
+	void workerLoop();
+	void runChunks();
+
+	std::vector<std::thread> threads;
+	std::mutex submitMutex, mutex;
+	std::condition_variable wakeUp, finished;
+	const std::function<void(unsigned, unsigned)>* job = nullptr;
+	unsigned jobCount = 0, jobChunk = 0, busyWorkers = 0;
+	std::atomic<unsigned> nextChunk{0};
+	uint64_t generation = 0;
+	bool quitting = false;
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include "DrawingFloat.h"
+#include "DrawingPacked.h"
+
+// Points (or size×size squares) to plot in one go. Stored as structure of arrays so that the conversion and clipping
+// passes run over plain float/int arrays (vectorizable), and only the final scatter touches the framebuffer.
+// Keep the batch alive across frames (clear() it) so that its arrays don't get reallocated.
+struct PointBatch {
+	std::vector<float> x, y;
+	std::vector<float> c0, c1, c2; // color components, in the color space of the target surface
+
+	void clear() {
+		x.clear(), y.clear(), c0.clear(), c1.clear(), c2.clear();
+	}
+
+	void reserve(unsigned count) {
+		x.reserve(count), y.reserve(count), c0.reserve(count), c1.reserve(count), c2.reserve(count);
+	}
+
+	unsigned size() const { return unsigned(x.size()); }
+
+	void add(float px, float py, Color color) {
+		x.push_back(px), y.push_back(py);
+		c0.push_back(color.components[0]), c1.push_back(color.components[1]), c2.push_back(color.components[2]);
+	}
+
+	// Converts the positions to pixel coordinates (truncated like setPixel does) and lists the points whose anchor is
+	// inside the w×h area. Returns how many there are (indices in visible[0..count)).
+	unsigned clip(unsigned w, unsigned h) {
+		const unsigned n = size();
+		ix.resize(n), iy.resize(n), visible.resize(n);
+		for (unsigned i = 0; i < n; i++) {
+			ix[i] = int(x[i]);
+			iy[i] = int(y[i]);
+		}
+		unsigned count = 0;
+		for (unsigned i = 0; i < n; i++) {
+			visible[count] = i;
+			count += (unsigned(ix[i]) < w) & (unsigned(iy[i]) < h);
+		}
+		return count;
+	}
+
+	std::vector<int> ix, iy;
+	std::vector<unsigned> visible;
+};
+
+template<ColorSpace Space, Overflow Policy>
+static void drawPoints(BasicDrawingSurface<Space, Policy>& ds, PointBatch& batch, unsigned size = 1) {
+	const unsigned count = batch.clip(ds.w, ds.h);
+	for (unsigned k = 0; k < count; k++) {
+		const unsigned i = batch.visible[k];
+		const unsigned x = batch.ix[i], y = batch.iy[i];
+		const float c0 = batch.c0[i], c1 = batch.c1[i], c2 = batch.c2[i];
+		if (size == 1) {
+			float* ptr = ds.pixelAt(x, y);
+			ptr[0] = c0, ptr[1] = c1, ptr[2] = c2;
+			continue;
+		}
+		const unsigned w = size < ds.w - x ? size : ds.w - x, h = size < ds.h - y ? size : ds.h - y;
+		for (unsigned j = 0; j < h; j++) {
+			ds.forEachSpan(x, y + j, w, [&](float* ptr, unsigned spanCount) {
+				for (unsigned l = 0; l < spanCount; l++, ptr += 4) {
+					ptr[0] = c0, ptr[1] = c1, ptr[2] = c2;
+				}
+			});
+		}
+	}
+}
+
+static void drawPoints(PackedDrawingSurface& ds, PointBatch& batch, unsigned size = 1) {
+	const unsigned count = batch.clip(ds.w, ds.h);
+	Uint32* const pixels = ds.pixels;
+	for (unsigned k = 0; k < count; k++) {
+		const unsigned i = batch.visible[k];
+		const unsigned x = batch.ix[i], y = batch.iy[i];
+		const Uint32 color = PackedDrawingSurface::pack(Color(batch.c0[i], batch.c1[i], batch.c2[i]));
+		if (size == 1) {
+			pixels[y * ds.pitch + x] = color;
+			continue;
+		}
+		const unsigned w = size < ds.w - x ? size : ds.w - x, h = size < ds.h - y ? size : ds.h - y;
+		for (unsigned j = 0; j < h; j++) {
+			std::fill_n(pixels + (y + j) * ds.pitch + x, w, color);
+		}
+	}
+}
@@ -7,6 +7,9 @@
 #endif
 #include <stdio.h>
 #include <cstddef>
+#include <atomic>
+#include <utility>
+#include "BufferPool.h"
 
 #ifdef REF_DEBUG
 extern unsigned g_allocCount;
@@ -22,15 +25,28 @@ extern void REF_PRINTREMAINING();
 #define REF_LOGRELEASET(t)
 #endif
 
+// The count can be changed from several threads at once (e.g. a spectrum read by the analysis and the routines).
+// Taking a reference is relaxed (the caller already holds one), dropping one is acq_rel so that whatever a thread did
+// with the object happens before the delete on the thread dropping the last reference.
 struct RefClass {
-	unsigned __ref_count;		// -1 => freed (an unmanaged object will be left at 0)
+	std::atomic<unsigned> __ref_count;		// number of refs - 1; -1 => freed (an unmanaged object will be left at 0)
 	RefClass() : __ref_count(0) { REF_LOGALLOC(this); }
-	~RefClass() { REF_LOGRELEASE(this); if ((int)__ref_count > 0) fprintf(stderr, "!!!!!!! Freeing an object that is still retained elsewhere\n"); }
+	~RefClass() { REF_LOGRELEASE(this); if ((int)__ref_count.load(std::memory_order_relaxed) > 0) fprintf(stderr, "!!!!!!! Freeing an object that is still retained elsewhere\n"); }
 	// Not allowed if not redefined properly!!! (i.e. do not copy the __ref_count)
 	RefClass(const RefClass& other);
 	RefClass& operator =(const RefClass&other);
 };
 
+// Inherit this instead of RefClass for objects created and freed at a high rate: their memory is recycled through the
+// BufferPool instead of the heap, so they don't show up in its heap allocation counter once the frames are steady.
+struct PooledRefClass : RefClass {
+	// Virtual so that deleting through a base pointer passes the size of the actual object to operator delete (the
+	// BufferPool files blocks by size)
+	virtual ~PooledRefClass() {}
+	static void* operator new(size_t size) { return BufferPool::shared().allocate(size); }
+	static void operator delete(void* ptr, size_t size) { BufferPool::shared().release(ptr, size); }
+};
+
 template<class T>
 struct ref {
 	T *ptr;
@@ -40,10 +56,12 @@ struct ref {
 	ref(std::nullptr_t p) : ptr(0) {}
 	ref(T* eptr, bool takeOwnership) : ptr(eptr) { REF_LOGALLOCT(typeid(T).name()); }
 	ref(const ref &ref) : ptr(ref.ptr) { incref(); }
-	ref(const ref &&other) : ptr(other.ptr) { other.ptr = NULL; }
-	ref(ref &&temp) : ptr(temp.ptr) { temp.ptr = nullptr; }
+	// Moves just steal the pointer, the count is not touched
+	ref(ref &&temp) noexcept : ptr(temp.ptr) { temp.ptr = nullptr; }
 	template<class U>
 	ref(const ref<U> &ref) : ptr(ref.ptr) { incref(); }
+	template<class U>
+	ref(ref<U> &&temp) noexcept : ptr(temp.ptr) { temp.ptr = nullptr; }
 	/************************************************************************/
 	/* If you get an error around here, it means that you are trying to use */
 	/* a class that is not inheriting RefClass!                             */
@@ -63,7 +81,11 @@ struct ref {
 	template<class U>
 	ref<T> &operator = (const ref<U> &ref) { return (*this) <<= ref.ptr; }
 	ref& operator = (const ref &ref) { return (*this) <<= ref.ptr; }
-	ref& operator = (ref &&temp) { decref(); ptr = temp.ptr; temp.ptr = nullptr; return *this; }
+	ref& operator = (ref &&temp) noexcept {
+		if (this != &temp) { decref(); ptr = temp.ptr; temp.ptr = nullptr; }
+		return *this;
+	}
+	void swap(ref &other) noexcept { std::swap(ptr, other.ptr); }
 	T* operator -> () const { return ptr; }
 	T& operator * () const { return *ptr; }
 	operator T * () const { return ptr; }
@@ -80,9 +102,9 @@ struct ref {
 	T* unmanaged_ptr() { incref(); return ptr; }
 
 private:
-	void incref() { if (ptr) ptr->__ref_count++; }
-	void incref(T *eptr) { if (eptr) eptr->__ref_count++; }
-	void decref() { if (ptr && !ptr->__ref_count--) { REF_LOGRELEASET(typeid(T).name()); delete ptr; } }
+	void incref() { incref(ptr); }
+	void incref(T *eptr) { if (eptr) eptr->__ref_count.fetch_add(1, std::memory_order_relaxed); }
+	void decref() { if (ptr && !ptr->__ref_count.fetch_sub(1, std::memory_order_acq_rel)) { REF_LOGRELEASET(typeid(T).name()); delete ptr; } }
 };
 
 /**
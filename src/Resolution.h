@@ -0,0 +1,59 @@
+#pragma once
+#include "DrawingFloat.h"
+
+// Dynamic resolution: watches the cost of the frames (drawing + present) against the frame budget and changes the size
+// of the surface of the routine, if it allowed it (see allowDynamicResolution). The sizes are the window size divided
+// by an integer, so that the upscale stays the fused integer one.
+struct ResolutionController {
+	double lowerAbove = 0.85;	// fraction of the budget above which the resolution goes down
+	double raiseBelow = 0.45;	// and below which it may go up, if the estimated cost at the next size stays under lowerAbove
+	unsigned framesBeforeLower = 10, framesBeforeRaise = 120;
+
+	explicit ResolutionController(double budget) : budget(budget) {}
+
+	// After each present. Returns true if the surface was resized.
+	bool update(PresentableSurface& surface, unsigned windowW, unsigned windowH, double frameCost) {
+		if (!surface.maxDivisor || !surface.sdlSurface->w) return false;
+		averageCost = framesSeen ? averageCost * 0.9 + frameCost * 0.1 : frameCost;
+		framesSeen++;
+
+		const unsigned divisor = windowW / surface.sdlSurface->w;
+		unsigned next = 0;
+		if (averageCost > lowerAbove * budget) {
+			overBudget++, underBudget = 0;
+			if (overBudget >= framesBeforeLower) next = nextDivisor(divisor, windowW, windowH, surface.maxDivisor, +1);
+		}
+		else if (averageCost < raiseBelow * budget) {
+			underBudget++, overBudget = 0;
+			if (underBudget >= framesBeforeRaise) {
+				next = nextDivisor(divisor, windowW, windowH, surface.minDivisor, -1);
+				// The cost goes with the number of pixels, don't go up to go back down right after
+				if (next && averageCost * divisor * divisor / (next * next) > lowerAbove * budget) next = 0;
+			}
+		}
+		else {
+			overBudget = underBudget = 0;
+		}
+		if (!next || !SurfacePool::shared().resize(&surface, windowW / next, windowH / next)) return false;
+		reset();
+		return true;
+	}
+
+	// The costs measured so far don't apply anymore (other routine)
+	void reset() {
+		framesSeen = overBudget = underBudget = 0;
+	}
+
+private:
+	// Closest divisor of both window dimensions in the direction, up to limit; 0 if none
+	static unsigned nextDivisor(unsigned divisor, unsigned windowW, unsigned windowH, unsigned limit, int direction) {
+		for (unsigned d = divisor + direction; d >= 1 && (direction > 0 ? d <= limit : d >= limit); d += direction) {
+			if (windowW % d == 0 && windowH % d == 0) return d;
+		}
+		return 0;
+	}
+
+	const double budget;
+	double averageCost = 0;
+	unsigned framesSeen = 0, overBudget = 0, underBudget = 0;
+};
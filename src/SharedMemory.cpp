@@ -0,0 +1,132 @@
+#include "SharedMemory.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Slots start on their own cache lines
+static uint64_t alignToCacheLine(uint64_t bytes) {
+	return (bytes + 63) & ~uint64_t(63);
+}
+
+static uint64_t monotonicNanoseconds() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+bool SharedPublisher::open(const char* name, uint32_t maxValues, uint32_t maxFrameWidth, uint32_t maxFrameHeight, uint32_t spectrumSlots, uint32_t frameSlots) {
+	close();
+	const uint64_t spectrumStride = alignToCacheLine(offsetof(SharedSpectrumSlot, values) + uint64_t(maxValues) * sizeof(double));
+	const uint64_t frameStride = alignToCacheLine(offsetof(SharedFrameSlot, pixels) + uint64_t(maxFrameWidth) * maxFrameHeight * sizeof(uint32_t));
+	const uint64_t spectrumOffset = alignToCacheLine(sizeof(SharedHeader));
+	const uint64_t frameOffset = spectrumOffset + spectrumSlots * spectrumStride;
+	const uint64_t totalBytes = frameOffset + frameSlots * frameStride;
+
+	// Left over by a publisher that crashed: the readers still mapping it keep their (stale) copy
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		perror("shm_open");
+		return false;
+	}
+	if (ftruncate(fd, off_t(totalBytes)) != 0) {
+		perror("ftruncate");
+		::close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	void* mapping = mmap(nullptr, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED) {
+		perror("mmap");
+		shm_unlink(name);
+		return false;
+	}
+
+	// Zero-filled by ftruncate: all sequences are even and nothing is published yet
+	header = (SharedHeader*)mapping;
+	header->version = SHARED_VERSION;
+	header->spectrumSlots = spectrumSlots;
+	header->maxValues = maxValues;
+	header->frameSlots = frameSlots;
+	header->maxPixels = maxFrameWidth * maxFrameHeight;
+	header->spectrumOffset = spectrumOffset;
+	header->spectrumStride = spectrumStride;
+	header->frameOffset = frameOffset;
+	header->frameStride = frameStride;
+	header->totalBytes = totalBytes;
+	header->magic.store(SHARED_MAGIC, std::memory_order_release);
+	strncpy(this->name, name, sizeof(this->name) - 1);
+	this->name[sizeof(this->name) - 1] = '\0';
+	printf("Publishing to shared memory %s (%u KB)\n", name, unsigned(totalBytes / 1024));
+	return true;
+}
+
+void SharedPublisher::close() {
+	if (!header) return;
+	munmap(header, header->totalBytes);
+	shm_unlink(name);
+	header = nullptr;
+}
+
+void SharedPublisher::publishSpectrum(const double* valuesDb, unsigned count, double minFrequency, double maxFrequency, bool logSpaced, const AudioFeatures& features) {
+	if (!header) return;
+	uint64_t index = header->spectraPublished.load(std::memory_order_relaxed);
+	SharedSpectrumSlot* slot = header->spectrum(index);
+	uint32_t sequence = slot->sequence.load(std::memory_order_relaxed);
+	slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->count = count < header->maxValues ? count : header->maxValues;
+	slot->hop = index;
+	slot->monotonicNs = monotonicNanoseconds();
+	slot->minFrequency = minFrequency;
+	slot->maxFrequency = maxFrequency;
+	slot->logSpaced = logSpaced;
+	slot->features = features;
+	memcpy(slot->values, valuesDb, slot->count * sizeof(double));
+
+	slot->sequence.store(sequence + 2, std::memory_order_release);
+	header->spectraPublished.store(index + 1, std::memory_order_release);
+}
+
+void SharedPublisher::publishFrame(const void* pixels, unsigned width, unsigned height, unsigned pitch) {
+	if (!header) return;
+	if (uint64_t(width) * height > header->maxPixels) {
+		droppedFrames += 1;
+		return;
+	}
+	uint64_t index = header->framesPublished.load(std::memory_order_relaxed);
+	SharedFrameSlot* slot = header->frame(index);
+	uint32_t sequence = slot->sequence.load(std::memory_order_relaxed);
+	slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->width = width;
+	slot->height = height;
+	slot->frame = index;
+	slot->monotonicNs = monotonicNanoseconds();
+	const uint8_t* src = (const uint8_t*)pixels;
+	for (unsigned y = 0; y < height; y++, src += pitch) {
+		memcpy(slot->pixels + y * width, src, width * sizeof(uint32_t));
+	}
+
+	slot->sequence.store(sequence + 2, std::memory_order_release);
+	header->framesPublished.store(index + 1, std::memory_order_release);
+}
+
+#else
+bool SharedPublisher::open(const char*, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) {
+	fprintf(stderr, "Shared memory publication is only available on POSIX systems\n");
+	return false;
+}
+
+void SharedPublisher::close() {}
+void SharedPublisher::publishSpectrum(const double*, unsigned, double, double, bool, const AudioFeatures&) {}
+void SharedPublisher::publishFrame(const void*, unsigned, unsigned, unsigned) {}
+#endif
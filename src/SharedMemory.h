@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "Features.h"
+
+// Publication of the analysis and of the rendered frames to other processes of the host (lighting bridge, recorder...),
+// through a POSIX shared memory object laid out as below. Each slot is guarded by a sequence counter (seqlock): odd
+// while the publisher writes it, so that readers use the data in place and only check afterwards that the counter
+// didn't move, without locks or syscalls. The slots form a ring, so that a reader slightly behind still gets whole ones.
+//
+// Reading a slot (see tools/ShmReader.cpp):
+//	uint32_t before = slot->sequence.load(std::memory_order_acquire);
+//	if (before & 1) -> being written, retry
+//	... use the data in place ...
+//	std::atomic_thread_fence(std::memory_order_acquire);
+//	if (slot->sequence.load(std::memory_order_relaxed) != before) -> overwritten meanwhile, discard what was read
+static const uint32_t SHARED_MAGIC = 0x56434853; // "SHCV"
+static const uint32_t SHARED_VERSION = 1;
+
+struct SharedSpectrumSlot {
+	std::atomic<uint32_t> sequence;
+	uint32_t count;					// values used (up to SharedHeader::maxValues)
+	uint64_t hop;					// index of this publication
+	uint64_t monotonicNs;			// CLOCK_MONOTONIC when published
+	double minFrequency, maxFrequency;
+	uint32_t logSpaced;				// like FeatureExtractor::update
+	uint32_t padding;
+	AudioFeatures features;
+	double values[1];				// dB, maxValues of them
+};
+
+struct SharedFrameSlot {
+	std::atomic<uint32_t> sequence;
+	uint32_t width, height;			// pitch = width
+	uint32_t padding;
+	uint64_t frame;
+	uint64_t monotonicNs;
+	uint32_t pixels[1];				// ARGB, maxPixels of them
+};
+
+struct SharedHeader {
+	std::atomic<uint32_t> magic;	// SHARED_MAGIC once the rest is initialized
+	uint32_t version;
+	uint32_t spectrumSlots, maxValues;
+	uint32_t frameSlots, maxPixels;
+	uint64_t spectrumOffset, spectrumStride;	// from the start of the mapping, in bytes
+	uint64_t frameOffset, frameStride;
+	uint64_t totalBytes;
+	// Publications so far; the latest is in slot (published - 1) % slots
+	std::atomic<uint64_t> spectraPublished, framesPublished;
+
+	SharedSpectrumSlot* spectrum(uint64_t index) { return (SharedSpectrumSlot*)((uint8_t*)this + spectrumOffset + index % spectrumSlots * spectrumStride); }
+	SharedFrameSlot* frame(uint64_t index) { return (SharedFrameSlot*)((uint8_t*)this + frameOffset + index % frameSlots * frameStride); }
+};
+
+// Publisher side. Without open() (or off POSIX systems), publishing does nothing.
+struct SharedPublisher {
+	SharedPublisher() {}
+	~SharedPublisher() { close(); }
+	SharedPublisher(const SharedPublisher&) = delete; // disallowed
+
+	// name: like "/challengevince". Returns false if it failed (see the message printed).
+	bool open(const char* name, uint32_t maxValues, uint32_t maxFrameWidth, uint32_t maxFrameHeight, uint32_t spectrumSlots = 16, uint32_t frameSlots = 3);
+	// Also removes the name
+	void close();
+	bool isOpen() const { return header != nullptr; }
+
+	// Once per analysis hop. While the publisher is open, the app keeps the analysis out of sparse mode (see
+	// DftProcessor::addSparsePoint), so the spectrum is whole and published on every hop, whatever the effect.
+	void publishSpectrum(const double* valuesDb, unsigned count, double minFrequency, double maxFrequency, bool logSpaced, const AudioFeatures& features);
+	// 32-bit pixels, pitch in bytes. Frames bigger than the maximum given to open() are dropped.
+	void publishFrame(const void* pixels, unsigned width, unsigned height, unsigned pitch);
+
+	uint64_t droppedFrames = 0;
+
+private:
+	SharedHeader* header = nullptr;
+	char name[256];
+};
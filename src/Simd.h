@@ -0,0 +1,8 @@
+#pragma once
+
+// SSE2: always there on x86-64, optional on 32-bit x86 (/arch:SSE2, -msse2). The vectorized loops are under
+// #ifdef USE_SSE2, next to their scalar version.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+#include "BufferPool.h"
+
+// Lock-free ring between exactly one producer thread (e.g. the audio callback) and one consumer thread. Neither side
+// ever blocks: write() keeps what fits, read() takes what is there.
+template<typename T>
+struct SpscRing {
+	// capacity is rounded up to a power of 2
+	explicit SpscRing(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity) size *= 2;
+		items.resize(size);
+		mask = size - 1;
+	}
+	SpscRing(const SpscRing&) = delete; // disallowed
+
+	// Producer. Returns how many items were written (the rest didn't fit).
+	size_t write(const T* src, size_t count) {
+		const size_t head = writeIndex.load(std::memory_order_relaxed);
+		const size_t free = items.size() - (head - readIndex.load(std::memory_order_acquire));
+		if (count > free) count = free;
+		copyIn(head, src, count);
+		writeIndex.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer. Returns how many items were read.
+	size_t read(T* dst, size_t maxCount) {
+		const size_t tail = readIndex.load(std::memory_order_relaxed);
+		size_t count = writeIndex.load(std::memory_order_acquire) - tail;
+		if (count > maxCount) count = maxCount;
+		copyOut(tail, dst, count);
+		readIndex.store(tail + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer: oldest item (nullptr if empty), stays in the ring until pop()
+	const T* peek() const {
+		const size_t tail = readIndex.load(std::memory_order_relaxed);
+		return writeIndex.load(std::memory_order_acquire) != tail ? &items[tail & mask] : nullptr;
+	}
+	void pop() { readIndex.store(readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	// Approximate when called from a third thread
+	size_t size() const { return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire); }
+	size_t capacity() const { return items.size(); }
+
+private:
+	// In at most two parts, around the end of the storage
+	void copyIn(size_t index, const T* src, size_t count) {
+		size_t start = index & mask, first = count < items.size() - start ? count : items.size() - start;
+		memcpy(&items[start], src, first * sizeof(T));
+		memcpy(&items[0], src + first, (count - first) * sizeof(T));
+	}
+	void copyOut(size_t index, T* dst, size_t count) const {
+		size_t start = index & mask, first = count < items.size() - start ? count : items.size() - start;
+		memcpy(dst, &items[start], first * sizeof(T));
+		memcpy(dst + first, &items[0], (count - first) * sizeof(T));
+	}
+
+	pooled_vector<T> items;
+	size_t mask;
+	// Free-running indices, on separate cache lines so that both sides don't keep invalidating each other
+	alignas(64) std::atomic<size_t> writeIndex{0};
+	alignas(64) std::atomic<size_t> readIndex{0};
+};
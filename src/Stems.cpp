@@ -0,0 +1,102 @@
+#include "Stems.h"
+#include <algorithm>
+
+void StemSet::loadFiles(const char* const* fileNames, unsigned count) {
+	for (unsigned i = 0; i < count; i++) {
+		SDL_AudioSpec fileSpec;
+		uint8_t* buffer;
+		uint32_t length;
+		if (!SDL_LoadWAV(fileNames[i], &fileSpec, &buffer, &length)) {
+			fprintf(stderr, "Failed to load WAV file %s\n", fileNames[i]);
+			throw "Failed to load a stem";
+		}
+		if (fileSpec.format != AUDIO_S16LSB || fileSpec.channels < 1 || fileSpec.channels > 2 || (i > 0 && fileSpec.freq != spec.freq)) {
+			SDL_FreeWAV(buffer);
+			fprintf(stderr, "Stem %s: only 16-bit, mono or stereo WAV files at the same rate are supported\n", fileNames[i]);
+			throw "Unsupported stem format";
+		}
+		spec.freq = fileSpec.freq;
+
+		// Name without the path and extension
+		std::string name(fileNames[i]);
+		size_t slash = name.find_last_of("/\\");
+		if (slash != std::string::npos) name.erase(0, slash + 1);
+		size_t dot = name.find_last_of('.');
+		if (dot != std::string::npos) name.erase(dot);
+
+		const int16_t* samples = (const int16_t*)buffer;
+		const uint32_t frameCount = length / 2 / fileSpec.channels;
+		if (fileSpec.channels == 2) {
+			addStem(name.c_str(), samples, frameCount, fileSpec.freq);
+		}
+		else {
+			pooled_vector<int16_t> stereo(frameCount * 2);
+			for (uint32_t j = 0; j < frameCount; j++) stereo[j * 2] = stereo[j * 2 + 1] = samples[j];
+			addStem(name.c_str(), to_array(stereo), frameCount, fileSpec.freq);
+		}
+		SDL_FreeWAV(buffer);
+	}
+}
+
+void StemSet::loadChannelPairs(const int16_t* samples, uint32_t frameCount, const SDL_AudioSpec& fileSpec, const char* name) {
+	const unsigned channels = fileSpec.channels;
+	pooled_vector<int16_t> stereo(frameCount * 2);
+	for (unsigned left = 0; left < channels; left += 2) {
+		const unsigned right = left + 1 < channels ? left + 1 : left;
+		for (uint32_t j = 0; j < frameCount; j++) {
+			stereo[j * 2] = samples[j * channels + left];
+			stereo[j * 2 + 1] = samples[j * channels + right];
+		}
+		char stemName[256];
+		snprintf(stemName, sizeof(stemName), "%s %u-%u", name, left + 1, right + 1);
+		addStem(stemName, to_array(stereo), frameCount, fileSpec.freq);
+	}
+}
+
+void StemSet::addStem(const char* name, const int16_t* stereoSamples, uint32_t frameCount, int sampleRate) {
+	auto stem = std::make_unique<Stem>();
+	stem->name = name;
+	stem->samples.assign(stereoSamples, stereoSamples + frameCount * 2);
+	stems.push_back(std::move(stem));
+	frames = std::max(frames, frameCount);
+	spec.freq = sampleRate;
+}
+
+void StemSet::finishLoading(unsigned samplesPerIteration) {
+	spec.format = AUDIO_S16LSB;
+	spec.channels = 2;
+	spec.samples = 4096;
+
+	// The analyzers keep pointers to the samples and the spec: everything gets its final size first
+	std::vector<int32_t> sum(frames * 2);
+	for (auto& stem : stems) {
+		stem->samples.resize(frames * 2);
+		stem->spec = spec;
+		for (uint32_t i = 0; i < frames * 2; i++) sum[i] += stem->samples[i];
+	}
+	mix.resize(frames * 2);
+	for (uint32_t i = 0; i < frames * 2; i++) mix[i] = int16_t(std::clamp(sum[i], -32768, 32767));
+
+	for (auto& stem : stems) {
+		stem->processor = std::make_unique<DftProcessor>(samplesPerIteration);
+		stem->analyzer = std::make_unique<DftProcessorForWav>(*stem->processor, to_array(stem->samples), frames * 4, stem->spec);
+	}
+}
+
+void StemSet::processWithMix(DftProcessorForWav& mixAnalyzer, const std::function<void(DftProcessorForWav&)>& analyze, WorkerPool& pool) {
+	for (auto& stem : stems) {
+		stem->processor->useConversionToFrequencyDomainValues = mixAnalyzer.processor.useConversionToFrequencyDomainValues;
+		stem->processor->useWindow = mixAnalyzer.processor.useWindow;
+		// Not processed while no effect used the stems, or the mix was moved
+		if (stem->analyzer->waveBufferOffset != mixAnalyzer.waveBufferOffset) stem->analyzer->seek(mixAnalyzer.waveBufferOffset);
+	}
+
+	// Each analyzer only touches its own state: one job per stream, the mix being job 0
+	pool.parallelFor(count() + 1, 1, [&](unsigned begin, unsigned end) {
+		for (unsigned i = begin; i < end; i++) analyze(i == 0 ? mixAnalyzer : *stems[i - 1]->analyzer);
+	});
+}
+
+void StemSet::setLoop(uint32_t start, uint32_t end) {
+	for (auto& stem : stems) stem->analyzer->setLoop(start, end);
+}
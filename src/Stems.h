@@ -0,0 +1,53 @@
+#pragma once
+#include <SDL.h>
+#include <memory>
+#include <string>
+#include <functional>
+#include "DftProcessor.h"
+#include "Parallel.h"
+
+// Multitrack mode: the song as separate stems (drums, bass, vocals…), each one with its own analyzer so that effects
+// can follow one of them. The stems are summed into a mix, which is what gets played and what the main
+// DftProcessorForWav analyzes. All the stems are stereo 16-bit at the same rate and length.
+struct StemSet {
+	struct Stem {
+		std::string name;
+		pooled_vector<int16_t> samples;
+		SDL_AudioSpec spec;
+		std::unique_ptr<DftProcessor> processor;
+		std::unique_ptr<DftProcessorForWav> analyzer;
+	};
+
+	StemSet() {}
+	StemSet(const StemSet&) = delete; // disallowed
+
+	// One stem per file (16-bit, mono or stereo, same rate); shorter ones are padded with silence. Throws on error.
+	void loadFiles(const char* const* fileNames, unsigned count);
+	// One stem per pair of channels of a 16-bit multichannel file (a last odd channel is played on both sides)
+	void loadChannelPairs(const int16_t* samples, uint32_t frames, const SDL_AudioSpec& spec, const char* name);
+	// Lower level: add the stems, then finishLoading once to get the mix and the analyzers
+	void addStem(const char* name, const int16_t* stereoSamples, uint32_t frames, int sampleRate);
+	void finishLoading(unsigned samplesPerIteration);
+
+	unsigned count() const { return unsigned(stems.size()); }
+	const Stem& stem(unsigned index) const { return *stems[index]; }
+	// The analyzers' output (filled as configured by the routine, like the main one)
+	const pooled_vector<double>& spectrum(unsigned index) const { return stems[index]->analyzer->currentDFT(); }
+	const pooled_vector<double>& bands(unsigned index) const { return stems[index]->analyzer->currentBands(); }
+
+	const int16_t* mixSamples() const { return to_array(mix); }
+	uint32_t totalSamples() const { return frames; }
+	const SDL_AudioSpec& mixSpec() const { return spec; }
+
+	// Runs analyze on the mix analyzer and on every stem at once, on the worker pool. The stems follow the position of
+	// the mix (a seek is picked up here) and its processor options.
+	void processWithMix(DftProcessorForWav& mixAnalyzer, const std::function<void(DftProcessorForWav&)>& analyze, WorkerPool& pool = WorkerPool::shared());
+	void setLoop(uint32_t start, uint32_t end);
+	void clearLoop() { setLoop(0, 0); }
+
+private:
+	std::vector<std::unique_ptr<Stem>> stems;
+	pooled_vector<int16_t> mix;
+	uint32_t frames = 0;
+	SDL_AudioSpec spec = {};
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include "DrawingFloat.h"
+#include "Simd.h"
+
+// out = a + (b - a) * t / 256 on each 8-bit channel, t in [0, 256]
+static inline void mixArgbRow(const Uint32* a, const Uint32* b, Uint32* out, unsigned count, unsigned t) {
+	unsigned x = 0;
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weightB = _mm_set1_epi16(short(t)), weightA = _mm_set1_epi16(short(256 - t));
+	for (; x + 4 <= count; x += 4) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + x)), vb = _mm_loadu_si128((const __m128i*)(b + x));
+		// 255 * 256 still fits in an unsigned 16-bit lane
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), weightA), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), weightB));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), weightA), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), weightB));
+		_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+	}
+#endif
+	for (; x < count; x++) {
+		Uint32 pa = a[x], pb = b[x];
+		Uint32 rb = ((pa & 0xff00ff) * (256 - t) + (pb & 0xff00ff) * t) >> 8 & 0xff00ff;
+		Uint32 ag = ((pa >> 8 & 0xff00ff) * (256 - t) + (pb >> 8 & 0xff00ff) * t) & 0xff00ff00;
+		out[x] = ag | rb;
+	}
+}
+
+// Crossfade between the routine being replaced and the new one. Both keep running at the same time in their own surface
+// and with their own analysis (see FrameScheduler); each one is upscaled to the window size and the two images are mixed.
+struct Crossfade {
+	double duration = 0.75; // seconds
+	bool active = false;
+
+	Crossfade() {}
+	Crossfade(const Crossfade&) = delete; // disallowed
+	~Crossfade() {
+		if (outgoingFrame) SDL_FreeSurface(outgoingFrame);
+	}
+
+	void start(double time) {
+		startTime = time;
+		active = true;
+	}
+
+	// 0 = only the outgoing routine is visible, 1 = only the incoming one
+	double progress(double time) const {
+		double t = (time - startTime) / duration;
+		return t < 0 ? 0 : t > 1 ? 1 : t;
+	}
+
+	void present(PresentableSurface& outgoing, PresentableSurface& incoming, SDL_Surface* dst, unsigned dstW, unsigned dstH, double progress) {
+		incoming.presentTo(dst, dstW, dstH);
+		if (!Upscaler::isCompatibleDestination(dst)) return;
+
+		// Only reallocated when the window gets resized
+		if (!outgoingFrame || outgoingFrame->w != dst->w || outgoingFrame->h != dst->h) {
+			if (outgoingFrame) SDL_FreeSurface(outgoingFrame);
+			outgoingFrame = SDL_CreateRGBSurface(0, dst->w, dst->h, 32, 0xff << 16, 0xff << 8, 0xff, 0xff << 24);
+			memset(outgoingFrame->pixels, 0, size_t(outgoingFrame->pitch) * outgoingFrame->h);
+		}
+		outgoing.presentTo(outgoingFrame, dstW, dstH);
+
+		if (SDL_MUSTLOCK(dst) && SDL_LockSurface(dst) < 0) return;
+		const unsigned t = unsigned(progress * 256);
+		WorkerPool::shared().parallelFor(unsigned(dst->h), 16, [&](unsigned begin, unsigned end) {
+			for (unsigned y = begin; y < end; y++) {
+				const Uint32* a = (const Uint32*)((const Uint8*)outgoingFrame->pixels + y * outgoingFrame->pitch);
+				Uint32* b = (Uint32*)((Uint8*)dst->pixels + y * dst->pitch);
+				mixArgbRow(a, b, b, unsigned(dst->w), t);
+			}
+		});
+		if (SDL_MUSTLOCK(dst)) SDL_UnlockSurface(dst);
+	}
+
+private:
+	double startTime = 0;
+	SDL_Surface* outgoingFrame = nullptr;
+};
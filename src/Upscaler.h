@@ -0,0 +1,124 @@
+#pragma once
+#include <SDL.h>
+#include <memory.h>
+#include <vector>
+#include "Parallel.h"
+#include "Simd.h"
+
+// Nearest-neighbour integer upscaling straight into a 32-bit xRGB destination (typically the window surface).
+// The source is never materialized: a converter callback produces each source row in ARGB8888 just before it gets
+// expanded, so the float -> ARGB conversion and the scaling happen in a single pass, one band of rows per thread.
+namespace Upscaler {
+	// Writes every source pixel N times. N = 0 means that the factor is only known at runtime.
+	template<unsigned N>
+	static inline void expandRow(const Uint32* src, Uint32* dst, unsigned srcW, unsigned runtimeN) {
+		if constexpr (N == 1) {
+			memcpy(dst, src, srcW * sizeof(Uint32));
+			return;
+		}
+		unsigned x = 0;
+#ifdef USE_SSE2
+		if constexpr (N == 2) {
+			for (; x + 4 <= srcW; x += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+				_mm_storeu_si128((__m128i*)(dst + x * 2), _mm_unpacklo_epi32(v, v));
+				_mm_storeu_si128((__m128i*)(dst + x * 2 + 4), _mm_unpackhi_epi32(v, v));
+			}
+		}
+		else if constexpr (N == 4) {
+			for (; x + 4 <= srcW; x += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+				_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+				_mm_storeu_si128((__m128i*)(dst + x * 4 + 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+				_mm_storeu_si128((__m128i*)(dst + x * 4 + 8), _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+				_mm_storeu_si128((__m128i*)(dst + x * 4 + 12), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+			}
+		}
+		else if constexpr (N == 3) {
+			for (; x + 4 <= srcW; x += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+				// a a a b | b b c c | c d d d
+				_mm_storeu_si128((__m128i*)(dst + x * 3), _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+				_mm_storeu_si128((__m128i*)(dst + x * 3 + 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+				_mm_storeu_si128((__m128i*)(dst + x * 3 + 8), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+			}
+		}
+#endif
+		const unsigned n = N ? N : runtimeN;
+		for (; x < srcW; x++) {
+			Uint32 pixel = src[x];
+			Uint32* out = dst + x * n;
+			if constexpr (N > 0) {
+				for (unsigned i = 0; i < N; i++) out[i] = pixel;
+			}
+			else {
+				for (unsigned i = 0; i < n; i++) out[i] = pixel;
+			}
+		}
+	}
+
+	template<unsigned N, typename RowConverter, typename BandPreparer>
+	static void upscaleRows(SDL_Surface* dst, unsigned srcW, unsigned srcH, unsigned runtimeN, RowConverter& convertRow, unsigned minBand, BandPreparer& prepareBand) {
+		const unsigned n = N ? N : runtimeN;
+		const unsigned dstPitch = unsigned(dst->pitch) / sizeof(Uint32);
+		Uint32* const dstPixels = (Uint32*)dst->pixels;
+
+		WorkerPool::shared().parallelFor(srcH, minBand, [&](unsigned begin, unsigned end) {
+			static thread_local std::vector<Uint32> rowBuffer;
+			if (rowBuffer.size() < srcW) rowBuffer.resize(srcW);
+			prepareBand(begin, end);
+
+			for (unsigned y = begin; y < end; y++) {
+				Uint32* firstLine = dstPixels + y * n * dstPitch;
+				// With N = 1 there is no expansion so we can convert straight into the destination
+				if (n == 1) {
+					convertRow(y, firstLine);
+					continue;
+				}
+				convertRow(y, rowBuffer.data());
+				expandRow<N>(rowBuffer.data(), firstLine, srcW, n);
+				for (unsigned i = 1; i < n; i++) {
+					memcpy(firstLine + i * dstPitch, firstLine, srcW * n * sizeof(Uint32));
+				}
+			}
+		});
+	}
+
+	static inline bool isCompatibleDestination(const SDL_Surface* dst) {
+		const SDL_PixelFormat* format = dst->format;
+		return format->BytesPerPixel == 4 && format->Rmask == 0xff0000 && format->Gmask == 0xff00 && format->Bmask == 0xff;
+	}
+
+	// Same as blitIntegerScaled, in bands of at least minBand rows: prepareBand(begin, end) is called on the thread of
+	// each band before its rows get converted (e.g. to compute them). Returns false without calling anything if dst is
+	// not 32-bit xRGB.
+	template<typename RowConverter, typename BandPreparer>
+	static bool blitIntegerScaledInBands(SDL_Surface* dst, unsigned srcW, unsigned srcH, unsigned minBand, BandPreparer prepareBand, RowConverter convertRow) {
+		if (!isCompatibleDestination(dst) || srcW == 0 || srcH == 0) return false;
+		unsigned scaleX = unsigned(dst->w) / srcW, scaleY = unsigned(dst->h) / srcH;
+		unsigned n = scaleX < scaleY ? scaleX : scaleY;
+		if (n == 0) return false;
+
+		if (SDL_MUSTLOCK(dst) && SDL_LockSurface(dst) < 0) return false;
+		switch (n) {
+		case 1: upscaleRows<1>(dst, srcW, srcH, n, convertRow, minBand, prepareBand); break;
+		case 2: upscaleRows<2>(dst, srcW, srcH, n, convertRow, minBand, prepareBand); break;
+		case 3: upscaleRows<3>(dst, srcW, srcH, n, convertRow, minBand, prepareBand); break;
+		case 4: upscaleRows<4>(dst, srcW, srcH, n, convertRow, minBand, prepareBand); break;
+		case 5: upscaleRows<5>(dst, srcW, srcH, n, convertRow, minBand, prepareBand); break;
+		case 6: upscaleRows<6>(dst, srcW, srcH, n, convertRow, minBand, prepareBand); break;
+		default: upscaleRows<0>(dst, srcW, srcH, n, convertRow, minBand, prepareBand); break;
+		}
+		if (SDL_MUSTLOCK(dst)) SDL_UnlockSurface(dst);
+		return true;
+	}
+
+	// Upscales by the largest integer factor that fits in dst, anchored at the top-left corner like SDL_BlitScaled was.
+	// convertRow(y, Uint32* out) must write srcW ARGB8888 pixels. Returns false if dst is not 32-bit xRGB.
+	// inOrder: convertRow is called for y = 0, 1, 2… on the calling thread (it may depend on the previous rows)
+	template<typename RowConverter>
+	static bool blitIntegerScaled(SDL_Surface* dst, unsigned srcW, unsigned srcH, RowConverter convertRow, bool inOrder = false) {
+		// In order: a single band, on the calling thread
+		return blitIntegerScaledInBands(dst, srcW, srcH, inOrder ? srcH : 8, [](unsigned, unsigned) {}, convertRow);
+	}
+}
@@ -1,7 +1,19 @@
 ﻿#include "DftProcessor.h"
+#include "AudioPlayer.h"
+#include "Stems.h"
+#include "AudioInput.h"
+#include "Features.h"
+#include "CatchUp.h"
 //#include "DrawingSurface.h"
 #include "DrawingFloat.h"
+#include "DrawingPacked.h"
+#include "PrimitiveBatch.h"
+#include "Lines.h"
+#include "Transition.h"
+#include "Resolution.h"
+#include "SharedMemory.h"
 #include "Coroutines.h"
+#include <thread>
 
 /*
  *	Idées:
@@ -15,19 +27,25 @@
 
 static auto DEFAULT_MUSIC_FILENAME = "../music.wav";
 static const double MAX_RENDERED_FRAMERATE = 60;
+static const unsigned DFT_SAMPLES_PER_ITERATION = 128;
 
 struct Globals {
 	unsigned processChunksAtOnce = 6;
 	bool wantsFullFrequencies = true; // if false, just computes the volume, same value on all bands
+	bool wantsMultiResolution = false; // updates dftProcessor.currentBands() instead of currentDFT()
+	unsigned decimationStages = 0; // currentDFT() then only covers [0, dftProcessor.analyzedSampleRate() / 2]
+	const StemSet* stems = nullptr; // multitrack mode only
+	bool wantsStems = false; // also analyzes each stem (same options as the mix), see stems->spectrum()
+	bool wantsSlidingDft = false; // currentDFT() follows the playback at the display rate (see processSlidingAndSmooth)
+	AudioFeatures features; // of the mix, updated once per analysis hop
+	bool wantsFeatures = false; // reads features: the spectrum they come from then never uses sparse bins
 	SDL_Scancode lastPressedKey = SDL_SCANCODE_UNKNOWN;
 	// For programs using the rosace
 	double n = 6, d = 8, extraSensitivity = 0;
 };
 
-ReturnObject testWithHSLFramebuffer(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
-	auto& ds = createDrawingSurface(240, 160, 3_X);
-	ds.protectOverflow = true;
-	ds.useHsl = true;
+Task testWithHSLFramebuffer(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
+	auto& ds = createDrawingSurface<HslDrawingSurface>(240, 160, 3_X);
 	globals.processChunksAtOnce = 3;
 	globals.wantsFullFrequencies = false;
 
@@ -42,165 +60,174 @@ ReturnObject testWithHSLFramebuffer(Globals& globals, DftProcessorForWav& dftPro
 		}
 		s += 0.001;
 
-		co_await std::suspend_always{};
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject pointCloudLateralScrollingOnly(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
+Task pointCloudLateralScrollingOnly(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
 	double theta = 0;
 	auto currentColor = [&] {
-		return HSV(fmodf(theta / 4, 360), 100, 50);
+		return Color(HSV(fmodf(theta / 4, 360), 100, 50));
 	};
 	auto currentAccentColor = [&] {
 		return HSV(fmodf(theta / 4 + 180, 360), 50, 100);
 	};
 
-	auto& ds = createDrawingSurface(240, 160, 3_X);
+	auto& ds = createDrawingSurface<ClampedDrawingSurface>(240, 160, 3_X);
 	ds.clearScreen(currentColor());
-	ds.protectOverflow = true;
 	globals.processChunksAtOnce = 3;
 	globals.wantsFullFrequencies = false;
+	globals.wantsFeatures = true;
 
-	ScreenMover screen;
+	double scrollPosition = 0;
+	PointBatch points;
 	while (true) {
-		auto& dftOut(dftProcessor.currentDFT());
 		processor.useConversionToFrequencyDomainValues = false;
 		processor.useWindow = false;
 
 		// https://www.asc.ohio-state.edu/orban.14/math_coding/rose/rose.html
-		double volume = processor.convertPointToDecibels(dftOut[0], 35_DB + globals.extraSensitivity);
+		double volume = processor.convertPointToDecibels(globals.features.level, 35_DB + globals.extraSensitivity);
 		Color color(currentAccentColor());
+		points.clear();
 		for (unsigned k = 0; k < 40; k++) {
 			double rmax = volume * 160;
 			double r = rmax * cos(globals.n / globals.d * theta);
 			double x = r * cos(theta);
 			double y = r * sin(theta);
-			ds.setPixel(x + ds.w / 2, y + ds.h / 2, Color(300, 300, 300));
+			points.add(x + ds.w / 2, y + ds.h / 2, Color(300, 300, 300));
 			theta += 0.004;
 		}
+		drawPoints(ds, points);
 
-		screen.stashMove(0.5, 0);
-		screen.performMove(ds, currentColor(), 40);
-		co_await std::suspend_always{};
+		// Moves the origin of the surface, only the column coming in is written
+		scrollPosition += 0.5;
+		int scrollBy = int(scrollPosition);
+		scrollPosition -= scrollBy;
+		if (scrollBy) ds.scroll(scrollBy, 0, currentColor());
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject pointCloudWithColorfulScrollingBackground(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
+Task pointCloudWithColorfulScrollingBackground(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
 	double screenAngle = 0;
 	double theta = 0;
 	auto currentColor = [&] {
-		return HSV(fmodf(theta / 4, 360), 100, 50);
+		return Color(HSV(fmodf(theta / 4, 360), 100, 50));
 	};
 	auto currentAccentColor = [&] {
 		return HSV(fmodf(theta / 4 + 180, 360), 50, 100);
 	};
 	ScreenMover screen;
-	auto& ds = createDrawingSurface(240, 160, 3_X);
+	auto& ds = createDrawingSurface<ClampedDrawingSurface>(240, 160, 3_X);
 	ds.clearScreen(currentColor());
-	ds.protectOverflow = true;
 	globals.processChunksAtOnce = 1;
 	globals.wantsFullFrequencies = false;
+	globals.wantsFeatures = true;
 
-
+	PointBatch points;
 	while (true) {
-		auto& dftOut(dftProcessor.currentDFT());
 		processor.useConversionToFrequencyDomainValues = false;
 		processor.useWindow = false;
 
-		double volume = processor.convertPointToDecibels(dftOut[0], 35_DB + globals.extraSensitivity);
+		double volume = processor.convertPointToDecibels(globals.features.level, 35_DB + globals.extraSensitivity);
 		Color color(currentAccentColor());
+		points.clear();
 		for (unsigned k = 0; k < 15; k++) {
 			double rmax = volume * 160;
 			double r = rmax * cos(globals.n / globals.d * theta);
 			double x = r * cos(theta);
 			double y = r * sin(theta);
-			ds.setPixel(x + ds.w / 2, y + ds.h / 2, Color(128, 128, 128).add(color));
+			points.add(x + ds.w / 2, y + ds.h / 2, Color(128, 128, 128).add(color));
 			theta += 0.004;
 		}
+		drawPoints(ds, points);
 
 		screenAngle += 0.0003;
 		screen.stashMove(cos(screenAngle) * 0.2, sin(screenAngle) * 0.2);
 		screen.performMove(ds, currentColor(), 40);
-		co_await std::suspend_always{};
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject colorfulRosaceRGB(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
+Task colorfulRosaceRGB(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
 	double screenAngle = 0;
 	double theta = 0;
+	float hueShift = 0;
 	auto currentColor = [&] {
 		return Color(64, 64, 64);
 	};
 	ScreenMover screen;
-	auto& ds = createDrawingSurface(240, 160, 3_X);
+	auto& ds = createDrawingSurface<ClampedDrawingSurface>(240, 160, 3_X);
 	ds.clearScreen(currentColor());
-	ds.protectOverflow = true;
 	globals.processChunksAtOnce = 1;
 	globals.wantsFullFrequencies = false;
+	globals.wantsFeatures = true;
 
-
+	PointBatch points;
 	while (true) {
-		auto& dftOut(dftProcessor.currentDFT());
 		processor.useConversionToFrequencyDomainValues = false;
 		processor.useWindow = false;
 
-		double volume = processor.convertPointToDecibels(dftOut[0], 35_DB + globals.extraSensitivity);
+		double volume = processor.convertPointToDecibels(globals.features.level, 35_DB + globals.extraSensitivity);
+		// The colors turn by a quarter on each beat
+		if (globals.features.beat) hueShift = fmodf(hueShift + 90, 360);
+		points.clear();
 		for (unsigned k = 0; k < 15; k++) {
 			double rmax = volume * 160;
 			double r = rmax * cos(globals.n / globals.d * theta);
 			double x = r * cos(theta);
 			double y = r * sin(theta);
-			Uint32 color = HSV(fmodf(theta * 360, 360), 100, 100);
-			ds.fillRect(x + ds.w / 2, y + ds.h / 2, 2, 2, color);
+			Color color(HSV(fmodf(theta * 360 + hueShift, 360), 100, 100));
+			points.add(x + ds.w / 2, y + ds.h / 2, color);
 			theta += 0.004;
 		}
+		drawPoints(ds, points, 2);
 
 		screenAngle += 0.0003;
 		screen.stashMove(cos(screenAngle) * 0.2, sin(screenAngle) * 0.2);
 		screen.performMove(ds, currentColor(), 32);
-		co_await std::suspend_always{};
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject colorfulRosaceHSL(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
+Task colorfulRosaceHSL(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
 	double screenAngle = 0;
 	double theta = 0;
 	auto currentColor = [&] {
 		return Color(0, 0, 0);
 	};
 	ScreenMover screen;
-	auto& ds = createDrawingSurface(240, 160, 3_X);
+	auto& ds = createDrawingSurface<HslDrawingSurface>(240, 160, 3_X);
 	ds.clearScreen(currentColor());
-	ds.protectOverflow = true;
-	ds.useHsl = true;
 	globals.processChunksAtOnce = 1;
 	globals.wantsFullFrequencies = false;
+	globals.wantsFeatures = true;
 
-
+	PointBatch points;
 	while (true) {
-		auto& dftOut(dftProcessor.currentDFT());
 		processor.useConversionToFrequencyDomainValues = false;
 		processor.useWindow = false;
 
-		double volume = processor.convertPointToDecibels(dftOut[0], 35_DB + globals.extraSensitivity);
+		double volume = processor.convertPointToDecibels(globals.features.level, 35_DB + globals.extraSensitivity);
+		points.clear();
 		for (unsigned k = 0; k < 15; k++) {
 			double rmax = volume * 160;
 			double r = rmax * cos(globals.n / globals.d * theta);
 			double x = r * cos(theta);
 			double y = r * sin(theta);
-			Color color(fmodf(theta, 1), 1, .5f);
-			ds.fillRect(x + ds.w / 2, y + ds.h / 2, 2, 2, color);
+			points.add(x + ds.w / 2, y + ds.h / 2, Color(fmodf(theta, 1), 1, .5f));
 			theta += 0.004;
 		}
+		drawPoints(ds, points, 2);
 
 		screenAngle += 0.0003;
 		screen.stashMove(cos(screenAngle) * 0.2, sin(screenAngle) * 0.2);
 		screen.performMoveInHSLMode(ds, currentColor(), 40);
-		co_await std::suspend_always{};
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject colorfulRotatingParticles(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
+Task colorfulRotatingParticles(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
 	double screenAngle = 0;
 	double theta = 0;
 	auto currentColor = [&] {
@@ -208,75 +235,96 @@ ReturnObject colorfulRotatingParticles(Globals& globals, DftProcessorForWav& dft
 	};
 	ScreenStretcher screen;
 	auto& ds = createDrawingSurface(240, 160, 3_X);
+	allowDynamicResolution(ds, 2_X, 4_X);
 	ds.clearScreen(currentColor());
 	globals.processChunksAtOnce = 6;
 	globals.wantsFullFrequencies = true;
 
+	// Only the bins of the points are analyzed
+	const unsigned totalSteps = 30;
+	for (unsigned k = 0; k < totalSteps; k++) processor.addSparsePoint(1 - double(k) / totalSteps, 50_Hz, wavSpec.freq / 2, true);
+
+	PointBatch points;
 	while (true) {
 		auto& dftOut(dftProcessor.currentDFT());
 		processor.useConversionToFrequencyDomainValues = false;
 		processor.useWindow = false;
 
-		unsigned totalSteps = 30;
+		points.clear();
 		for (unsigned k = 0; k < totalSteps; k++) {
 			double dftValue = processor.getDftPointInterpolated(to_array(dftOut), 1 - double(k) / totalSteps, 50_Hz, wavSpec.freq / 2, true);
 			double volume = processor.convertPointToDecibels(dftValue, 35_DB + globals.extraSensitivity);
-			double r = volume * 80, angle = 2 * M_PI * k / totalSteps + screenAngle;
+			double r = volume * ds.h / 2, angle = 2 * M_PI * k / totalSteps + screenAngle;
 			double x = r * cos(angle);
 			double y = r * -sin(angle);
-			Uint32 color = HSV(fmodf(angle * 720 / (2 * M_PI) + theta, 360), 100, 100);
-			ds.fillRect(x + ds.w / 2, y + ds.h / 2, 1, 1, color);
+			Color color(HSV(fmodf(angle * 720 / (2 * M_PI) + theta, 360), 100, 100));
+			points.add(x + ds.w / 2, y + ds.h / 2, color);
 		}
+		drawPoints(ds, points);
 
 		screenAngle += 0.03;
-		screen.stashMove(0.2);
+		// Same speed on screen whatever the resolution
+		screen.stashMove(0.2 * ds.h / 160);
 		screen.performCircular(ds, currentColor(), 60, true);
-		co_await std::suspend_always{};
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject smoothGraph(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
-	auto& ds = createDrawingSurface(480, 320, 1_X);
+Task smoothGraph(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
+	auto& ds = createDrawingSurface<PackedDrawingSurface>(480, 320, 1_X);
 	globals.processChunksAtOnce = 6;
 	globals.wantsFullFrequencies = true;
+	// One 128-point DFT would spread its first bin over the whole bass half of the graph
+	globals.wantsMultiResolution = true;
+
+	// The color of a lit cell only depends on its position
+	GradientSpanCache gradients;
+	gradients.build(320, 480, [](unsigned i, unsigned j) {
+		float angle = i * 320.0f / 320;
+		return HSV(angle, j * 140.0f / 256.f, 50 + j * 90.0f / 256.f);
+	});
 
 	ds.clearScreen(RGB(48, 48, 255));
 	while (true) {
-		auto& dftOut(dftProcessor.currentDFT());
-		processor.useConversionToFrequencyDomainValues = true;
-		processor.useWindow = false;
 		for (unsigned i = 0; i < 320; i++) {
-			float angle = i * 320.0f / 320;
-			double dftValue = processor.getDftPointInterpolated(to_array(dftOut), i / 320.0, 50_Hz, wavSpec.freq / 2, true);
+			double dftValue = dftProcessor.getBandInterpolated(i / 320.0);
 			double volume = processor.convertPointToDecibels(dftValue, 80_DB + globals.extraSensitivity);
 			unsigned vol = unsigned(volume * 256);
-			for (unsigned j = 0; j < 480; j++) {
-				uint32_t color = j > vol ? RGB(0, 0, 0) : HSV(angle, j * 140.0f / 256.f, 50 + j * 90.0f / 256.f);
-				ds.setPixel(j, i, color);
-			}
+			// Lit up to vol included
+			gradients.drawSpan(ds, i, 0, i, vol + 1, RGB(0, 0, 0));
 		}
 
-		co_await std::suspend_always{};
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject eqBars(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) noexcept {
+Task eqBars(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
 	bool useLinearScale = true;
-	auto& ds = createDrawingSurface(480, 320, 1_X);
+	auto& ds = createDrawingSurface<PackedDrawingSurface>(480, 320, 1_X);
 	globals.processChunksAtOnce = 6;
 	globals.wantsFullFrequencies = true;
+	printf("Note: D zooms on the lows (up to 1/8 of the sample rate, with 4x narrower bins)\n");
+
+	// The color of a lit cell only depends on its position
+	const unsigned barCount = unsigned(dftProcessor.currentDFT().size());
+	GradientSpanCache gradients;
+	gradients.build(barCount, 256, [&](unsigned i, unsigned j) {
+		float angle = i * 360.0f / barCount;
+		return HSV(angle, j * 140.0f / 256.f, 50 + j * 90.0f / 256.f);
+	});
 
 	ds.clearScreen(RGB(48, 48, 255));
 	while (true) {
+		// The bars are linear in frequency: the zoom keeps them on the part where the music is
+		if (globals.lastPressedKey == SDL_SCANCODE_D) globals.decimationStages = globals.decimationStages ? 0 : 2;
 		const unsigned BAR_HEIGHT = 4;
 		unsigned y = 0;
 		auto& dftOut(dftProcessor.currentDFT());
 		processor.useConversionToFrequencyDomainValues = false;
 		processor.useWindow = false;
 		for (unsigned i = 0; i < dftOut.size(); i++) {
-			float angle = i * 360.0f / dftOut.size();
 			double fraction = double(i) / (dftOut.size() - 1);
-			double sample = processor.getDftPointInterpolated(to_array(dftOut), fraction, 50_Hz, wavSpec.freq / 2, false);
+			double sample = processor.getDftPointInterpolated(to_array(dftOut), fraction, 50_Hz, dftProcessor.analyzedSampleRate() / 2, false);
 			unsigned vol;
 			if (useLinearScale) {
 				// Division by 60 because sometimes it goes slightly over 0
@@ -286,33 +334,146 @@ ReturnObject eqBars(Globals& globals, DftProcessorForWav& dftProcessor, DftProce
 				double volume = processor.convertPointToDecibels(sample, 50_DB + globals.extraSensitivity);
 				vol = unsigned(volume * 256);
 			}
-			for (unsigned j = 0; j < 256; j++) {
-				uint32_t color = j > vol ? RGB(0, 0, 0) : HSV(angle, j * 140.0f / 256.f, 50 + j * 90.0f / 256.f);
-				for (unsigned k = 0; k < BAR_HEIGHT; k++) {
-					ds.setPixel(j, y + k, color);
-				}
+			// Lit up to vol included
+			for (unsigned k = 0; k < BAR_HEIGHT; k++) {
+				gradients.drawSpan(ds, i, 0, y + k, vol + 1, RGB(0, 0, 0));
 			}
 			y += BAR_HEIGHT;
 		}
 
-		co_await std::suspend_always{};
+		co_await nextSpectrum();
 	}
 }
 
-ReturnObject (*drawingRoutines[])(Globals& globals, DftProcessorForWav&, DftProcessor&, SDL_AudioSpec&) noexcept = {
-	colorfulRotatingParticles,
-	pointCloudWithColorfulScrollingBackground,
-	eqBars,
-	smoothGraph,
-	colorfulRosaceRGB,
-	testWithHSLFramebuffer,
-	pointCloudLateralScrollingOnly,
-	colorfulRosaceHSL,
+// Idea 4: the spectrum as an anti-aliased wave, leaving a trail that goes up
+Task spectrumWaveform(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
+	double theta = 0;
+	ScreenMover screen;
+	auto& ds = createDrawingSurface<ClampedDrawingSurface>(240, 160, 3_X);
+	ds.clearScreen(Color(0, 0, 0));
+	globals.processChunksAtOnce = 3;
+	globals.wantsFullFrequencies = true;
+	// The wave follows the audio at the display rate
+	globals.wantsSlidingDft = true;
+
+	vector<float> xs(ds.w), ys(ds.w);
+	while (true) {
+		auto& dftOut(dftProcessor.currentDFT());
+		processor.useConversionToFrequencyDomainValues = false;
+		processor.useWindow = false;
+
+		for (unsigned i = 0; i < ds.w; i++) {
+			double dftValue = processor.getDftPointInterpolated(to_array(dftOut), double(i) / (ds.w - 1), 50_Hz, wavSpec.freq / 2, true);
+			double volume = processor.convertPointToDecibels(dftValue, 50_DB + globals.extraSensitivity);
+			xs[i] = float(i);
+			ys[i] = float(ds.h * 0.8 - volume * ds.h * 0.6);
+		}
+		Color color(HSV(fmodf(theta, 360), 80, 100));
+		drawPolylineAA<LineBlend::Additive>(ds, to_array(xs), to_array(ys), ds.w, color);
+		theta += 0.5;
+
+		screen.stashMove(0, -1);
+		screen.performMove(ds, Color(0, 0, 0), 48);
+		co_await nextSpectrum();
+	}
+}
+
+// Idea 5: spectrogram, the newest spectrum at the bottom and the history scrolling up
+Task spectrogram(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
+	auto& ds = createDrawingSurface<ClampedDrawingSurface>(240, 160, 3_X);
+	ds.clearScreen(Color(0, 0, 0));
+	globals.processChunksAtOnce = 3;
+	globals.wantsFullFrequencies = true;
+
+	while (true) {
+		auto& dftOut(dftProcessor.currentDFT());
+		processor.useConversionToFrequencyDomainValues = false;
+		processor.useWindow = false;
+
+		ds.scroll(0, -1, Color(0, 0, 0));
+		for (unsigned i = 0; i < ds.w; i++) {
+			double dftValue = processor.getDftPointInterpolated(to_array(dftOut), double(i) / (ds.w - 1), 50_Hz, wavSpec.freq / 2, true);
+			double volume = processor.convertPointToDecibels(dftValue, 50_DB + globals.extraSensitivity);
+			ds.setPixel(i, ds.h - 1, HSV(float(240 - volume * 240), 100, float(fmin(100, volume * 150))));
+		}
+		co_await nextSpectrum();
+	}
+}
+
+// One band per stem (multitrack mode), each showing the spectrum of that stem only
+Task stemSpectra(Globals& globals, DftProcessorForWav& dftProcessor, DftProcessor& processor, SDL_AudioSpec& wavSpec) {
+	if (!globals.stems) throw "Needs stems: pass one WAV file per stem, or a multichannel file";
+	auto& ds = createDrawingSurface<PackedDrawingSurface>(480, 320, 1_X);
+	globals.processChunksAtOnce = 6;
+	globals.wantsFullFrequencies = true;
+	globals.wantsStems = true;
+
+	const unsigned stemCount = globals.stems->count();
+	const unsigned bandHeight = ds.h / stemCount;
+	ds.clearScreen(RGB(0, 0, 0));
+	while (true) {
+		for (unsigned s = 0; s < stemCount; s++) {
+			auto& dftOut(globals.stems->spectrum(s));
+			float hue = s * 360.0f / stemCount;
+			for (unsigned x = 0; x < ds.w; x++) {
+				double dftValue = processor.getDftPointInterpolated(to_array(dftOut), double(x) / (ds.w - 1), 50_Hz, wavSpec.freq / 2, true);
+				double volume = processor.convertPointToDecibels(dftValue, 70_DB + globals.extraSensitivity);
+				unsigned height = unsigned(fmin(volume, 1) * (bandHeight - 1));
+				for (unsigned j = 0; j < bandHeight; j++) {
+					uint32_t color = j >= height ? RGB(0, 0, 0) : HSV(hue, 100, 30 + j * 70.0f / bandHeight);
+					ds.setPixel(x, s * bandHeight + bandHeight - 1 - j, color);
+				}
+			}
+		}
+
+		co_await nextSpectrum();
+	}
+}
+
+static const struct {
+	const char* name;
+	Task (*create)(Globals& globals, DftProcessorForWav&, DftProcessor&, SDL_AudioSpec&);
+} drawingRoutines[] = {
+#define ROUTINE(routine) { #routine, routine }
+	ROUTINE(colorfulRotatingParticles),
+	ROUTINE(pointCloudWithColorfulScrollingBackground),
+	ROUTINE(eqBars),
+	ROUTINE(smoothGraph),
+	ROUTINE(colorfulRosaceRGB),
+	ROUTINE(testWithHSLFramebuffer),
+	ROUTINE(pointCloudLateralScrollingOnly),
+	ROUTINE(colorfulRosaceHSL),
+	ROUTINE(spectrumWaveform),
+	ROUTINE(spectrogram),
+	ROUTINE(stemSpectra),
+#undef ROUTINE
+};
+
+// Each routine analyzes with its own options (its Globals, set when it starts, and the DftProcessor flags and sparse
+// bins it sets while running) into its own analyzer: the one being faded out keeps its spectrum during a crossfade, and
+// both can run at the same time. The settings of the main loop (keys, features) are copied into globals before a frame.
+struct RoutineAnalysis : RoutineContext {
+	RoutineAnalysis(const int16_t* samples, uint32_t wavLength, const SDL_AudioSpec& wavSpec)
+		: processor(DFT_SAMPLES_PER_ITERATION), analyzer(processor, samples, wavLength, wavSpec) {}
+
+	Globals globals;
+	DftProcessor processor;
+	DftProcessorForWav analyzer;
+	// Not the leading routine: samples the leading one went through that this one has yet to analyze
+	unsigned pendingSamples = 0;
 };
 
 int main(int argc, char* args[]) {
 #define QUIT() { system("pause"); return -1; }
 
+	// --publish name, before the other arguments: the spectra and frames are shared with other processes (see SharedMemory.h)
+	const char* publishName = nullptr;
+	if (argc >= 3 && !strcmp(args[1], "--publish")) {
+		publishName = args[2];
+		args[2] = args[0];
+		args += 2, argc -= 2;
+	}
+
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		fprintf(stderr, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
 		QUIT();
@@ -332,31 +493,91 @@ int main(int argc, char* args[]) {
 
 	SDL_AudioSpec wavSpec;
 	uint32_t wavLength;
-	uint8_t* wavBuffer;
+	uint8_t* wavBuffer = nullptr;
+	const int16_t* samples;
 	char fileName[4096];
+	// Multitrack mode: several files (one per stem), or one file with more than 2 channels
+	StemSet stems;
+	// Live mode: --capture (default input device), or --simulate-capture file.wav (replays it at the pace of a device)
+	std::unique_ptr<CaptureSource> capture;
+	std::unique_ptr<LiveWindow> liveWindow;
+	const bool wantsCapture = argc == 2 && !strcmp(args[1], "--capture");
+	const bool wantsSimulatedCapture = argc == 3 && !strcmp(args[1], "--simulate-capture");
 
-	if (argc == 2) {
-		strncpy(fileName, args[1], numberof(fileName));
-	} else {
-		strncpy(fileName, DEFAULT_MUSIC_FILENAME, numberof(fileName));
-		fprintf(stdout, "Note: you can pass the wav file to play as an argument (drag & drop on the executable)\nPlaying %s by default.\n", fileName);
+	SDL_Init(SDL_INIT_AUDIO);
+	if (wantsCapture) {
+		capture = std::make_unique<DeviceCapture>();
 	}
+	else if (argc > 2 && !wantsSimulatedCapture) {
+		try {
+			stems.loadFiles(args + 1, argc - 1);
+		}
+		catch (const char* message) {
+			fprintf(stderr, "%s\n", message);
+			QUIT();
+		}
+	}
+	else {
+		if (argc >= 2) {
+			strncpy(fileName, args[argc - 1], numberof(fileName));
+		} else {
+			strncpy(fileName, DEFAULT_MUSIC_FILENAME, numberof(fileName));
+			fprintf(stdout, "Note: you can pass the wav file to play as an argument (drag & drop on the executable), one file per stem, or --capture / --simulate-capture file.wav for live input (optionally after --publish name)\nPlaying %s by default.\n", fileName);
+		}
 
-	SDL_Init(SDL_INIT_AUDIO);
-	auto audioSpec = SDL_LoadWAV(fileName, &wavSpec, &wavBuffer, &wavLength);
-	if (!audioSpec) {
-		fprintf(stderr, "Failed to load WAV file %s\n", fileName);
-		QUIT();
+		auto audioSpec = SDL_LoadWAV(fileName, &wavSpec, &wavBuffer, &wavLength);
+		if (!audioSpec) {
+			fprintf(stderr, "Failed to load WAV file %s\n", fileName);
+			QUIT();
+		}
+
+		if (wavSpec.channels < 2 || wavSpec.format != 0x8010) {
+			fprintf(stderr, "Only 16-bit, stereo (or more channels, for stems) WAV files supported\n");
+			QUIT();
+		}
+		if (wantsSimulatedCapture) {
+			if (wavSpec.channels != 2) {
+				fprintf(stderr, "Only stereo WAV files can simulate a capture\n");
+				QUIT();
+			}
+			capture = std::make_unique<SimulatedCapture>((int16_t*)wavBuffer, wavLength / 4, wavSpec.freq);
+		}
+		else if (wavSpec.channels > 2) {
+			stems.loadChannelPairs((int16_t*)wavBuffer, wavLength / 2 / wavSpec.channels, wavSpec, fileName);
+			SDL_FreeWAV(wavBuffer);
+			wavBuffer = nullptr;
+		}
 	}
 
-	if (wavSpec.channels != 2 ||  wavSpec.format != 0x8010) {
-		fprintf(stderr, "Only 16-bit, stereo WAV files supported\n");
-		QUIT();
+	if (stems.count() > 0) {
+		// What gets played and analyzed as usual is the sum of the stems
+		stems.finishLoading(DFT_SAMPLES_PER_ITERATION);
+		wavSpec = stems.mixSpec();
+		samples = stems.mixSamples();
+		wavLength = stems.totalSamples() * 4;
+		printf("Multitrack mode, %u stems:", stems.count());
+		for (unsigned i = 0; i < stems.count(); i++) printf(" %s", stems.stem(i).name.c_str());
+		printf("\n");
+	}
+	else if (capture) {
+		// The analysis runs on the last seconds captured; the sound itself is already in the room
+		if (!capture->start()) {
+			fprintf(stderr, "Failed to start the audio capture: %s\n", SDL_GetError());
+			QUIT();
+		}
+		liveWindow = std::make_unique<LiveWindow>(capture->spec.freq * 10, 16384);
+		wavSpec = capture->spec;
+		samples = liveWindow->frames();
+		wavLength = liveWindow->capacityFrames() * 4;
+		printf("Live input (%s), blocks of %u frames at %d Hz\n", wantsCapture ? "capture device" : fileName, wavSpec.samples, wavSpec.freq);
+	}
+	else {
+		samples = (const int16_t*)wavBuffer;
 	}
 
-	SDL_AudioDeviceID deviceId = SDL_OpenAudioDevice(NULL, 0, &wavSpec, NULL, 0);
-	if (SDL_QueueAudio(deviceId, wavBuffer, wavLength)) {
-		fprintf(stderr, "Failed to queue audio\n");
+	AudioPlayer player(samples, wavLength / 4, wavSpec);
+	if (!capture && !player.open()) {
+		fprintf(stderr, "Failed to open audio device: %s\n", SDL_GetError());
 		QUIT();
 	}
 
@@ -366,101 +587,328 @@ int main(int argc, char* args[]) {
 	};
 	bool quit = false, needsRerender = true;
 	double lastProcessedTime, lastRenderedTime;
-	DftProcessor processor(128);
-	DftProcessorForWav dftProcessor(processor, (int16_t*)wavBuffer, wavLength, wavSpec);
 
-	// Process a first sample
-	dftProcessor.processDFT();
+	SharedPublisher publisher;
 	lastRenderedTime = lastProcessedTime = getTime();
-	SDL_PauseAudioDevice(deviceId, 0);
+	if (!capture) player.play();
 
 	//double currentVolume = 0;
 
 	SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
 	SDL_RenderClear(renderer);
 
+	// Settings of the main loop; each routine has its own copy (see RoutineAnalysis)
 	Globals globals;
+	if (stems.count() > 0) globals.stems = &stems;
+	FeatureExtractor featureExtractor;
+	bool featuresPaused = false; // during sparse hops
+	CatchUpPolicy catchUp;
 	int currentDrawingRoutine = 0;
-	std::coroutine_handle<> drawingCoroutine;
+	FrameScheduler scheduler;
 	double firstRenderedTime = getTime();
 	unsigned renderedFrames = 0, drawnFrames = 0;
+	bool framebufferDirty = false;
+	uint64_t heapAllocationsAtLastStats = BufferPool::shared().counters().heapAllocations;
+	Crossfade crossfade;
+	ResolutionController resolution(1 / MAX_RENDERED_FRAMERATE);
+	// Drawing since the last present
+	double frameCost = 0;
+	uint32_t loopStart = 0, loopEnd = 0;
+	// Same index as in the scheduler. The newest routine leads: its hop paces the analysis, and the features and the
+	// publication come from its spectrum.
+	auto analysisOf = [&](unsigned index) -> RoutineAnalysis& {
+		return *static_cast<RoutineAnalysis*>(scheduler.context(index));
+	};
+	auto leadingAnalysis = [&]() -> RoutineAnalysis& {
+		return analysisOf(scheduler.size() - 1);
+	};
+	auto shareSettings = [&](Globals& own) {
+		own.stems = globals.stems;
+		own.features = globals.features;
+		own.lastPressedKey = globals.lastPressedKey;
+		own.n = globals.n, own.d = globals.d, own.extraSensitivity = globals.extraSensitivity;
+	};
+	// All the analyses are moved together
+	auto seekAnalyses = [&](uint32_t position) {
+		for (unsigned i = 0; i < scheduler.size(); i++) {
+			analysisOf(i).analyzer.seek(position);
+			analysisOf(i).pendingSamples = 0;
+		}
+	};
+	// Starts the current routine next to the running one (if any), which is then faded out
 	auto useDrawingRoutine = [&] {
-		drawingCoroutine = drawingRoutines[currentDrawingRoutine](globals, dftProcessor, processor, wavSpec);
-		printf("Target framerate: %f\n", 1.0 / (double(processor.inSamplesPerIteration * globals.processChunksAtOnce) / wavSpec.freq));
+		// Only two routines at once: the one being faded out is dropped if we switch again during the crossfade
+		if (scheduler.size() >= 2) scheduler.remove(0);
+		bool hadRoutine = !scheduler.empty();
+
+		// A routine failing right away is skipped
+		for (unsigned attempts = 0; attempts < numberof(drawingRoutines); attempts++) {
+			auto& routine = drawingRoutines[currentDrawingRoutine];
+			// Analyzing from where the running routine is (fresh values, as after a seek)
+			auto owned = std::make_unique<RoutineAnalysis>(samples, wavLength, wavSpec);
+			RoutineAnalysis& analysis = *owned;
+			shareSettings(analysis.globals);
+			analysis.analyzer.setLoop(loopStart, loopEnd);
+			if (hadRoutine) analysis.analyzer.seek(leadingAnalysis().analyzer.waveBufferOffset);
+			else if (!capture) analysis.analyzer.processDFT();
+			try {
+				scheduler.add(routine.create(analysis.globals, analysis.analyzer, analysis.processor, wavSpec), routine.name, std::move(owned));
+				printf("Target framerate: %f\n", 1.0 / (double(analysis.processor.inSamplesPerIteration * analysis.globals.processChunksAtOnce) / wavSpec.freq));
+				if (hadRoutine) crossfade.start(getTime());
+				resolution.reset();
+				return;
+			}
+			catch (const char* message) {
+				fprintf(stderr, "Drawing routine %s failed: %s\n", routine.name, message);
+			}
+			catch (const std::exception& ex) {
+				fprintf(stderr, "Drawing routine %s failed: %s\n", routine.name, ex.what());
+			}
+			if (++currentDrawingRoutine >= int(numberof(drawingRoutines))) currentDrawingRoutine = 0;
+		}
 	};
 
 	useDrawingRoutine();
+	if (scheduler.empty()) {
+		fprintf(stderr, "No drawing routine could start\n");
+		QUIT();
+	}
+	// Largest window expected; bigger frames are not published
+	if (publishName && !publisher.open(publishName, std::max(leadingAnalysis().processor.outSamplesPerIteration, leadingAnalysis().analyzer.multiResolution.bandCount), 1920, 1200)) {
+		QUIT();
+	}
 	printf("Note: use left/right to cycle through effects. F1-F6 keys affect some parameters.\n");
+	printf("Home restarts, page up/down seek by 10 seconds, L sets the start, then the end of a loop, then removes it.\n");
 
-	while (!quit && !dftProcessor.wouldOverflowWavFile()) {
-		SDL_Event e;
-		globals.lastPressedKey = SDL_SCANCODE_UNKNOWN;
-		if (SDL_PollEvent(&e)) {
-			if (e.type == SDL_KEYDOWN) {
-				if (e.key.keysym.scancode == SDL_SCANCODE_RIGHT) {
-					if (++currentDrawingRoutine >= numberof(drawingRoutines)) currentDrawingRoutine = 0;
-					useDrawingRoutine();
-				}
-				else if (e.key.keysym.scancode == SDL_SCANCODE_LEFT) {
-					if (--currentDrawingRoutine < 0) currentDrawingRoutine = numberof(drawingRoutines) - 1;
-					useDrawingRoutine();
-				}
-				else if (e.key.keysym.scancode == SDL_SCANCODE_F1) {
-					globals.extraSensitivity -= 5;
-					printf("extra sensitivity=%f\n", globals.extraSensitivity);
-				}
-				else if (e.key.keysym.scancode == SDL_SCANCODE_F2) {
-					globals.extraSensitivity += 5;
-					printf("extra sensitivity=%f\n", globals.extraSensitivity);
-				}
-				else if (e.key.keysym.scancode == SDL_SCANCODE_F3) {
-					if (--globals.n < 1) globals.n = 1;
-					printf("n=%f, d=%f\n", globals.n, globals.d);
-				}
-				else if (e.key.keysym.scancode == SDL_SCANCODE_F4) {
-					globals.n++;
-					printf("n=%f, d=%f\n", globals.n, globals.d);
-				}
-				else if (e.key.keysym.scancode == SDL_SCANCODE_F5) {
-					if (--globals.d < 1) globals.d = 1;
-					printf("n=%f, d=%f\n", globals.n, globals.d);
-				}
-				else if (e.key.keysym.scancode == SDL_SCANCODE_F6) {
-					globals.d++;
-					printf("n=%f, d=%f\n", globals.n, globals.d);
-				}
-				else {
-					globals.lastPressedKey = e.key.keysym.scancode;
-				}
+	// Playback and analysis are moved together, without processing what was skipped
+	const uint32_t SEEK_STEP = wavSpec.freq * 10;
+	uint32_t loopMarker = UINT32_MAX;
+	auto seekTo = [&](int64_t position) {
+		if (capture) return;
+		uint32_t target = uint32_t(clamp<int64_t>(position, 0, leadingAnalysis().analyzer.waveTotalSamples));
+		player.seek(target);
+		seekAnalyses(target);
+		featureExtractor.reset();
+		lastProcessedTime = getTime();
+		printf("Position: %.1f s\n", double(target) / wavSpec.freq);
+	};
+	auto toggleLoop = [&] {
+		if (capture) return;
+		uint32_t position = player.position();
+		if (player.looping()) {
+			player.clearLoop();
+			loopStart = loopEnd = 0;
+			for (unsigned i = 0; i < scheduler.size(); i++) analysisOf(i).analyzer.clearLoop();
+			stems.clearLoop();
+			printf("Loop removed\n");
+		}
+		else if (loopMarker == UINT32_MAX) {
+			loopMarker = position;
+			printf("Loop start: %.1f s, press L again at the end\n", double(position) / wavSpec.freq);
+		}
+		else {
+			uint32_t start = std::min(loopMarker, position), end = std::max(loopMarker, position);
+			loopMarker = UINT32_MAX;
+			if (end - start < DFT_SAMPLES_PER_ITERATION) {
+				printf("Loop too short\n");
+				return;
+			}
+			player.setLoop(start, end);
+			loopStart = start, loopEnd = end;
+			for (unsigned i = 0; i < scheduler.size(); i++) analysisOf(i).analyzer.setLoop(start, end);
+			stems.setLoop(start, end);
+			printf("Looping %.1f-%.1f s\n", double(start) / wavSpec.freq, double(end) / wavSpec.freq);
+		}
+	};
+
+	auto handleEvent = [&](const SDL_Event& e) {
+		if (e.type == SDL_KEYDOWN) {
+			if (e.key.keysym.scancode == SDL_SCANCODE_RIGHT) {
+				if (++currentDrawingRoutine >= int(numberof(drawingRoutines))) currentDrawingRoutine = 0;
+				useDrawingRoutine();
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_LEFT) {
+				if (--currentDrawingRoutine < 0) currentDrawingRoutine = numberof(drawingRoutines) - 1;
+				useDrawingRoutine();
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_F1) {
+				globals.extraSensitivity -= 5;
+				printf("extra sensitivity=%f\n", globals.extraSensitivity);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_F2) {
+				globals.extraSensitivity += 5;
+				printf("extra sensitivity=%f\n", globals.extraSensitivity);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_F3) {
+				if (--globals.n < 1) globals.n = 1;
+				printf("n=%f, d=%f\n", globals.n, globals.d);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_F4) {
+				globals.n++;
+				printf("n=%f, d=%f\n", globals.n, globals.d);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_F5) {
+				if (--globals.d < 1) globals.d = 1;
+				printf("n=%f, d=%f\n", globals.n, globals.d);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_F6) {
+				globals.d++;
+				printf("n=%f, d=%f\n", globals.n, globals.d);
 			}
-			else if (e.type == SDL_QUIT) {
-				quit = true;
+			else if (e.key.keysym.scancode == SDL_SCANCODE_HOME) {
+				seekTo(0);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_PAGEUP) {
+				seekTo(int64_t(player.position()) - SEEK_STEP);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_PAGEDOWN) {
+				seekTo(int64_t(player.position()) + SEEK_STEP);
+			}
+			else if (e.key.keysym.scancode == SDL_SCANCODE_L) {
+				toggleLoop();
+			}
+			else {
+				globals.lastPressedKey = e.key.keysym.scancode;
+			}
+		}
+		else if (e.type == SDL_QUIT) {
+			quit = true;
+		}
+	};
+
+	// Sleeps in SDL_WaitEventTimeout (returning early on input), then spins for the last part as OS timers are coarse
+	auto waitUntil = [&](double deadline) {
+		const double SPIN_DURATION = 0.001;
+		double remaining = deadline - getTime();
+		if (remaining > SPIN_DURATION) {
+			SDL_Event e;
+			if (SDL_WaitEventTimeout(&e, int((remaining - SPIN_DURATION) * 1000))) {
+				handleEvent(e);
+				return;
 			}
 		}
+		while (getTime() < deadline) std::this_thread::yield();
+	};
+
+	// Live input: arrival time of the newest block pulled, and of the one the current spectrum includes (until shown)
+	uint64_t analyzedArrival = 0;
+	double latencySum = 0, latencyMax = 0;
+	unsigned latencyCount = 0, skippedHops = 0;
 
-		// Process frame
+	while (!quit && (capture || !leadingAnalysis().analyzer.wouldOverflowWavFile())) {
+		SDL_Event e;
+		while (SDL_PollEvent(&e)) handleEvent(e);
+
+		// Process frame: routines waiting for a spectrum run when there's a new one, the others at the display rate
+		bool spectrumArrived = needsRerender;
 		if (needsRerender) {
+			scheduler.notifySpectrum();
+			needsRerender = false;
+		}
+		if (spectrumArrived || getTime() - lastRenderedTime >= 1 / MAX_RENDERED_FRAMERATE) {
 			auto screenSurface = SDL_GetWindowSurface(window);
 
-			drawingCoroutine();
-			needsRerender = false;
-			drawnFrames += 1;
+			double drawStart = getTime();
+			for (unsigned i = 0; i < scheduler.size(); i++) shareSettings(analysisOf(i).globals);
+			try {
+				if (scheduler.runFrame(1 / MAX_RENDERED_FRAMERATE) > 0) {
+					framebufferDirty = true;
+					drawnFrames += 1;
+					// Seen by the routines: a key pressed from now on (including during waitUntil) is for the next frame
+					globals.lastPressedKey = SDL_SCANCODE_UNKNOWN;
+				}
+			}
+			catch (const char* message) {
+				fprintf(stderr, "Drawing routine %s failed: %s\n", drawingRoutines[currentDrawingRoutine].name, message);
+			}
+			catch (const std::exception& ex) {
+				fprintf(stderr, "Drawing routine %s failed: %s\n", drawingRoutines[currentDrawingRoutine].name, ex.what());
+			}
+			frameCost += getTime() - drawStart;
+			if (scheduler.empty()) {
+				if (++currentDrawingRoutine >= int(numberof(drawingRoutines))) currentDrawingRoutine = 0;
+				useDrawingRoutine();
+				if (scheduler.empty()) {
+					fprintf(stderr, "No drawing routine could start\n");
+					break;
+				}
+			}
+			// The mix changes every frame even if neither routine drew anything
+			if (crossfade.active) framebufferDirty = true;
+			if (crossfade.active && (scheduler.size() < 2 || crossfade.progress(getTime()) >= 1)) {
+				if (scheduler.size() >= 2) scheduler.remove(0);
+				crossfade.active = false;
+			}
 
 			double time = getTime();
-			if (time - lastRenderedTime >= 1 / MAX_RENDERED_FRAMERATE) {
+			if (framebufferDirty && time - lastRenderedTime >= 1 / MAX_RENDERED_FRAMERATE) {
 				lastRenderedTime += 1 / MAX_RENDERED_FRAMERATE;
 				if (lastRenderedTime < time - 1 / MAX_RENDERED_FRAMERATE) lastRenderedTime = time - 1 / MAX_RENDERED_FRAMERATE;
-				g_drawingSurface->blitToSdlSurface();
-				SDL_Rect srcRect = { 0, 0, g_sdlSurface->w, g_sdlSurface->h };
-				SDL_Rect dstRect = { 0, 0, int(SCREEN_WIDTH), int(SCREEN_HEIGHT) };
-				SDL_BlitScaled(g_sdlSurface, &srcRect, screenSurface, &dstRect);
+				framebufferDirty = false;
+				PresentableSurface* surface = scheduler.empty() ? nullptr : scheduler.surface(scheduler.size() - 1);
+				if (crossfade.active && scheduler.surface(0) && surface) {
+					crossfade.present(*scheduler.surface(0), *surface, screenSurface, SCREEN_WIDTH, SCREEN_HEIGHT, crossfade.progress(time));
+				}
+				else if (surface) {
+					surface->presentTo(screenSurface, SCREEN_WIDTH, SCREEN_HEIGHT);
+					// Not during a crossfade, which costs more than the routine alone
+					frameCost += getTime() - time;
+					if (resolution.update(*surface, SCREEN_WIDTH, SCREEN_HEIGHT, frameCost)) {
+						printf("Resolution: %ux%u\n", surface->sdlSurface->w, surface->sdlSurface->h);
+					}
+				}
+				frameCost = 0;
+				if (Upscaler::isCompatibleDestination(screenSurface)) {
+					publisher.publishFrame(screenSurface->pixels, std::min<unsigned>(SCREEN_WIDTH, screenSurface->w), std::min<unsigned>(SCREEN_HEIGHT, screenSurface->h), screenSurface->pitch);
+				}
+				else if (surface) {
+					// Window in another format: the routine's own ARGB surface, which presentTo has just filled (unscaled, no crossfade)
+					publisher.publishFrame(surface->sdlSurface->pixels, surface->sdlSurface->w, surface->sdlSurface->h, surface->sdlSurface->pitch);
+				}
 
 				SDL_UpdateWindowSurface(window);
 				SDL_RenderPresent(renderer);
+				if (analyzedArrival) {
+					// From the capture of the newest sample analyzed to the moment its frame is on screen
+					double latency = double(SDL_GetPerformanceCounter() - analyzedArrival) / performanceCounterFreq + capture->bufferLatency();
+					latencySum += latency;
+					latencyMax = fmax(latencyMax, latency);
+					latencyCount += 1;
+					analyzedArrival = 0;
+				}
 
 				renderedFrames += 1;
 				if (time - firstRenderedTime >= 5) {
-					printf("Average framerate: rendered=%f, drawn=%f\n", renderedFrames / (time - firstRenderedTime), drawnFrames / (time - firstRenderedTime));
+					PresentableSurface* shown = scheduler.empty() ? nullptr : scheduler.surface(scheduler.size() - 1);
+					printf("Average framerate: rendered=%f, drawn=%f, resolution %ux%u\n", renderedFrames / (time - firstRenderedTime), drawnFrames / (time - firstRenderedTime),
+						shown ? shown->sdlSurface->w : 0, shown ? shown->sdlSurface->h : 0);
+					if (!scheduler.empty()) {
+						auto& stats = scheduler.stats(scheduler.size() - 1);
+						printf("Routine %s: %u resumes, average %.3f ms, max %.3f ms (budget %.3f ms)\n", stats.name, stats.resumes, stats.averageCost * 1000, stats.maxCost * 1000, 1000 / MAX_RENDERED_FRAMERATE);
+						scheduler.resetStats();
+					}
+					// Once every kind of surface has been seen, switching effects and drawing frames should not hit the heap
+					BufferPool::Counters poolCounters = BufferPool::shared().counters();
+					if (poolCounters.heapAllocations != heapAllocationsAtLastStats) {
+						printf("Buffer pool: %u heap allocations (%u KB in use, %u KB cached)\n", unsigned(poolCounters.heapAllocations - heapAllocationsAtLastStats),
+							unsigned(poolCounters.bytesInUse / 1024), unsigned(poolCounters.bytesCached / 1024));
+						heapAllocationsAtLastStats = poolCounters.heapAllocations;
+					}
+					if (globals.features.tempo > 0) {
+						printf("Tempo: %.1f BPM (confidence %.2f)\n", globals.features.tempo, globals.features.tempoConfidence);
+					}
+					CatchUpPolicy::Counters catchUpCounters = catchUp.counters(time);
+					if (catchUpCounters.catchUps > 0 || catchUp.level() > 0) {
+						printf("Catch-up: %u times, %u hops dropped, degraded %u times (%.1f s, now at level %u)\n", catchUpCounters.catchUps,
+							unsigned(catchUpCounters.droppedHops), catchUpCounters.degradedIntervals, catchUpCounters.degradedSeconds, catchUp.level());
+					}
+					catchUp.resetCounters(time);
+					if (latencyCount > 0) {
+						printf("Input-to-photon latency: average %.1f ms, max %.1f ms (%.1f ms of capture buffer), %u hops skipped, %u frames dropped\n",
+							latencySum / latencyCount * 1000, latencyMax * 1000, capture->bufferLatency() * 1000, skippedHops, unsigned(capture->droppedFrames()));
+						latencySum = latencyMax = 0;
+						latencyCount = skippedHops = 0;
+					}
 					firstRenderedTime = time;
 					renderedFrames = drawnFrames = 0;
 				}
@@ -469,15 +917,108 @@ int main(int argc, char* args[]) {
 
 		// Wait until we have played the whole DFT'ed sample
 		double time = getTime();
-		unsigned samplesPerProcessing = processor.inSamplesPerIteration * globals.processChunksAtOnce;
+		RoutineAnalysis& leading = leadingAnalysis();
+		// Sliding DFT: a "hop" is a display frame, analyzing up to the playback position (not for live input, which
+		// already analyzes as soon as it has a hop)
+		auto slides = [&](const Globals& options) {
+			return options.wantsSlidingDft && options.wantsFullFrequencies && !options.wantsMultiResolution && !options.decimationStages && !capture;
+		};
+		const bool sliding = slides(leading.globals);
+		unsigned samplesPerProcessing = sliding ? unsigned(wavSpec.freq / MAX_RENDERED_FRAMERATE) : leading.processor.inSamplesPerIteration * leading.globals.processChunksAtOnce;
+		// Live input: analyzed as soon as a hop has arrived, dropping what is more than two hops late
+		if (capture) {
+			uint32_t offset = leading.analyzer.waveBufferOffset;
+			liveWindow->pull(*capture, leading.analyzer);
+			// The other analyses are at the same position (see below): they follow the compaction, and the skips
+			uint32_t compacted = offset - leading.analyzer.waveBufferOffset;
+			for (unsigned i = 0; compacted && i + 1 < scheduler.size(); i++) analysisOf(i).analyzer.rebase(compacted);
+			if (liveWindow->skipTo(leading.analyzer, samplesPerProcessing * 2)) {
+				seekAnalyses(leading.analyzer.waveBufferOffset);
+				skippedHops += 1;
+			}
+		}
 		auto processIfNecessary = [&] {
-			if ((time - lastProcessedTime) * wavSpec.freq >= samplesPerProcessing) {
-				lastProcessedTime += double(processor.inSamplesPerIteration * globals.processChunksAtOnce) / wavSpec.freq;
-				if (globals.wantsFullFrequencies) {
-					dftProcessor.processDFTInChunksAndSmooth(globals.processChunksAtOnce, 0.2);
+			if (capture ? liveWindow->available(leading.analyzer) >= samplesPerProcessing : (time - lastProcessedTime) * wavSpec.freq >= samplesPerProcessing) {
+				if (capture) {
+					lastProcessedTime = time;
+				}
+				else {
+					lastProcessedTime += double(samplesPerProcessing) / wavSpec.freq;
+				}
+				// Degraded (see CatchUpPolicy): the first chunks of the hop are passed over, only the latest are analyzed
+				const unsigned chunks = catchUp.chunksToAnalyze(leading.globals.processChunksAtOnce, time);
+				// What is heard now, not the fill cursor of the callback (which runs up to two device buffers ahead)
+				uint32_t playbackPosition = UINT32_MAX;
+				// Each routine with its own options, into its own analyzer
+				auto analyzeFor = [&](RoutineAnalysis& routine, unsigned chunks, unsigned skippedChunks) {
+					const Globals& options = routine.globals;
+					const bool slidingHere = slides(options);
+					if (slidingHere && playbackPosition == UINT32_MAX) playbackPosition = player.audiblePosition();
+					auto analyze = [&](DftProcessorForWav& analyzer) {
+						analyzer.setDecimationStages(options.decimationStages);
+						if (slidingHere) {
+							analyzer.processSlidingAndSmooth(playbackPosition, 0.2);
+							return;
+						}
+						analyzer.skipChunks(skippedChunks);
+						if (options.wantsMultiResolution) {
+							analyzer.processMultiResolutionAndSmooth(chunks, 0.2);
+						}
+						else if (options.wantsFullFrequencies) {
+							analyzer.processDFTInChunksAndSmooth(chunks, 0.2);
+						}
+						else {
+							analyzer.processVolumeOnly(chunks, 0.2);
+						}
+					};
+					if (options.stems && options.wantsStems) {
+						stems.processWithMix(routine.analyzer, analyze);
+					}
+					else {
+						analyze(routine.analyzer);
+					}
+				};
+				// The features and the publication come from the leading spectrum: whole while something uses them
+				bool wholeSpectrumUsed = publisher.isOpen();
+				for (unsigned i = 0; i < scheduler.size(); i++) wholeSpectrumUsed = wholeSpectrumUsed || analysisOf(i).globals.wantsFeatures;
+				leading.processor.useSparseBins = !wholeSpectrumUsed;
+				analyzeFor(leading, chunks, leading.globals.processChunksAtOnce - chunks);
+				// The routine being faded out goes through the same samples, in whole chunks of its own (all of them)
+				for (unsigned i = 0; i + 1 < scheduler.size(); i++) {
+					RoutineAnalysis& outgoing = analysisOf(i);
+					outgoing.pendingSamples += samplesPerProcessing;
+					unsigned outgoingChunks = outgoing.pendingSamples / outgoing.processor.inSamplesPerIteration;
+					outgoing.pendingSamples -= outgoingChunks * outgoing.processor.inSamplesPerIteration;
+					if (outgoingChunks > 0 || slides(outgoing.globals)) analyzeFor(outgoing, outgoingChunks, 0);
+				}
+				// Stamped with the block of the last frame analyzed, which can be up to two hops older than the newest pulled
+				if (capture) analyzedArrival = liveWindow->arrivalOf(leading.analyzer.waveBufferOffset - 1);
+
+				// Once for all the effects, from the leading routine's spectrum. Not from a sparse one (most bins are
+				// frozen), which only happens when nothing reads them: the features keep their last values, without the
+				// per-hop events, and start over afterwards.
+				double hopSeconds = double(samplesPerProcessing) / wavSpec.freq;
+				const bool sparseHop = leading.processor.sparse() && leading.globals.wantsFullFrequencies && !leading.globals.wantsMultiResolution && !sliding;
+				if (sparseHop) {
+					globals.features.onset = globals.features.beat = false;
+					featuresPaused = true;
 				}
 				else {
-					dftProcessor.processVolumeOnly(globals.processChunksAtOnce, 0.2);
+					DftProcessorForWav& analyzer = leading.analyzer;
+					if (featuresPaused) featureExtractor.reset();
+					featuresPaused = false;
+					if (leading.globals.wantsMultiResolution) {
+						featureExtractor.update(to_array(analyzer.currentBands()), analyzer.multiResolution.bandCount,
+							analyzer.multiResolution.minFrequency, wavSpec.freq / 2, true, hopSeconds);
+						publisher.publishSpectrum(to_array(analyzer.currentBands()), analyzer.multiResolution.bandCount,
+							analyzer.multiResolution.minFrequency, wavSpec.freq / 2, true, featureExtractor.current());
+					}
+					else {
+						featureExtractor.update(to_array(analyzer.currentDFT()), leading.processor.outSamplesPerIteration, 0, analyzer.analyzedSampleRate() / 2, false, hopSeconds);
+						publisher.publishSpectrum(to_array(analyzer.currentDFT()), leading.processor.outSamplesPerIteration, 0, analyzer.analyzedSampleRate() / 2, false,
+							featureExtractor.current());
+					}
+					globals.features = featureExtractor.current();
 				}
 
 				needsRerender = true;
@@ -486,17 +1027,38 @@ int main(int argc, char* args[]) {
 			return false;
 		};
 		processIfNecessary();
-		if ((time - lastProcessedTime) * wavSpec.freq >= samplesPerProcessing * 20) {
-			printf("Warning: lagging (lateness: %dx)\n", int((time - lastProcessedTime) * wavSpec.freq / samplesPerProcessing));
+		double lateness = (time - lastProcessedTime) * wavSpec.freq / samplesPerProcessing;
+		if (!capture && catchUp.isLate(lateness)) {
+			unsigned skipped = catchUp.onLate(lateness, time);
+			printf("Warning: lagging (lateness: %dx), %s\n", int(lateness), skipped ? "skipping to the playback position" : "catching up");
+			if (skipped) {
+				// Like a seek to the last hop played, which is then analyzed right away
+				uint32_t position = player.position();
+				seekAnalyses(position > samplesPerProcessing ? position - samplesPerProcessing : 0);
+				// Same as seekTo: no flux against the spectrum from before the jump (a false onset, and a gap in the tempo)
+				featureExtractor.reset();
+				lastProcessedTime = time - double(samplesPerProcessing) / wavSpec.freq;
+			}
 			while (processIfNecessary());
 		}
 
-		SDL_Delay(1);
+		// Sleep until the next analysis hop, or the next present if there is something to present
+		double deadline = lastProcessedTime + double(samplesPerProcessing) / wavSpec.freq;
+		if (capture) {
+			unsigned available = std::min(liveWindow->available(leading.analyzer), samplesPerProcessing);
+			deadline = time + double(samplesPerProcessing - available) / wavSpec.freq;
+		}
+		if (framebufferDirty || crossfade.active || scheduler.wantsFrameTicks()) {
+			deadline = fmin(deadline, lastRenderedTime + 1 / MAX_RENDERED_FRAMERATE);
+		}
+		waitUntil(deadline);
 	}
 
-	drawingCoroutine.destroy();
+	scheduler.clear();
+	publisher.close();
 	SDL_DestroyWindow(window);
-	SDL_CloseAudioDevice(deviceId);
+	player.close();
+	if (capture) capture->stop();
 	SDL_FreeWAV(wavBuffer);
 	SDL_Quit();
 #undef QUIT
@@ -0,0 +1,120 @@
+// Minimal consumer of what the visualizer publishes with --publish (see SharedMemory.h): maps the shared memory read
+// only and follows the latest spectrum and frame, using them in place. Prints once a second what it got, and how many
+// reads were discarded because the publisher overwrote the slot meanwhile.
+// Usage: ShmReader [name] [seconds]
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+#include "SharedMemory.h"
+
+static double monotonicSeconds() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* args[]) {
+	const char* name = argc > 1 ? args[1] : "/challengevince";
+	const double seconds = argc > 2 ? atof(args[2]) : 10;
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror("shm_open (is the visualizer running with --publish?)");
+		return 1;
+	}
+	struct stat info;
+	fstat(fd, &info);
+	void* mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	SharedHeader* header = (SharedHeader*)mapping;
+	if (header->magic.load(std::memory_order_acquire) != SHARED_MAGIC || header->version != SHARED_VERSION) {
+		fprintf(stderr, "%s is not a compatible publication\n", name);
+		return 1;
+	}
+	printf("%s: %u spectrum slots of %u values, %u frame slots of %u pixels\n", name, header->spectrumSlots, header->maxValues, header->frameSlots, header->maxPixels);
+
+	uint64_t lastSpectrum = header->spectraPublished.load(std::memory_order_acquire);
+	uint64_t lastFrame = header->framesPublished.load(std::memory_order_acquire);
+	unsigned spectra = 0, frames = 0, discarded = 0;
+	double start = monotonicSeconds(), lastReport = start, latencySum = 0;
+	while (monotonicSeconds() - start < seconds) {
+		uint64_t published = header->spectraPublished.load(std::memory_order_acquire);
+		if (published != lastSpectrum) {
+			SharedSpectrumSlot* slot = header->spectrum(published - 1);
+			uint32_t before = slot->sequence.load(std::memory_order_acquire);
+			// Strongest value, read in place
+			unsigned peak = 0;
+			uint32_t count = slot->count <= header->maxValues ? slot->count : 0;
+			for (unsigned i = 1; i < count; i++) {
+				if (slot->values[i] > slot->values[peak]) peak = i;
+			}
+			double peakDb = count ? slot->values[peak] : -100;
+			double fraction = count > 1 ? double(peak) / (count - 1) : 0;
+			double peakFrequency = slot->logSpaced ? slot->minFrequency * pow(slot->maxFrequency / slot->minFrequency, fraction)
+				: slot->minFrequency + fraction * (slot->maxFrequency - slot->minFrequency);
+			AudioFeatures features = slot->features;
+			uint64_t publishedNs = slot->monotonicNs;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if ((before & 1) || slot->sequence.load(std::memory_order_relaxed) != before) {
+				discarded++;
+			}
+			else {
+				lastSpectrum = published;
+				spectra++;
+				latencySum += monotonicSeconds() - publishedNs * 1e-9;
+				if (monotonicSeconds() - lastReport >= 1) {
+					printf("Spectrum %llu: peak %.1f dB at %.0f Hz, level %.1f dB, tempo %.1f BPM%s\n", (unsigned long long)(published - 1),
+						peakDb, peakFrequency, features.level, features.tempo, features.beat ? ", beat" : "");
+				}
+			}
+		}
+
+		published = header->framesPublished.load(std::memory_order_acquire);
+		if (published != lastFrame) {
+			SharedFrameSlot* slot = header->frame(published - 1);
+			uint32_t before = slot->sequence.load(std::memory_order_acquire);
+			// Average color, read in place
+			uint64_t pixels = uint64_t(slot->width) * slot->height, sum[3] = { 0, 0, 0 };
+			if (pixels > header->maxPixels) pixels = 0;
+			for (uint64_t i = 0; i < pixels; i++) {
+				uint32_t pixel = slot->pixels[i];
+				sum[0] += pixel >> 16 & 0xff, sum[1] += pixel >> 8 & 0xff, sum[2] += pixel & 0xff;
+			}
+			unsigned width = slot->width, height = slot->height;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if ((before & 1) || slot->sequence.load(std::memory_order_relaxed) != before) {
+				discarded++;
+			}
+			else {
+				lastFrame = published;
+				frames++;
+				if (monotonicSeconds() - lastReport >= 1 && pixels) {
+					printf("Frame %llu: %ux%u, average color %u %u %u\n", (unsigned long long)(published - 1), width, height,
+						unsigned(sum[0] / pixels), unsigned(sum[1] / pixels), unsigned(sum[2] / pixels));
+				}
+			}
+		}
+
+		double now = monotonicSeconds();
+		if (now - lastReport >= 1) {
+			printf("%u spectra (%.2f ms after publication on average), %u frames, %u reads discarded\n", spectra, spectra ? latencySum / spectra * 1000 : 0, frames, discarded);
+			spectra = frames = discarded = 0;
+			latencySum = 0;
+			lastReport = now;
+		}
+		// Polling: nothing on the hot path of the publisher
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	munmap(mapping, size_t(info.st_size));
+	return 0;
+}